@@ -47,6 +47,35 @@ struct OpenFile opentab[MAXOPEN] = {
 
 // Virtual address at which to receive page mappings containing client requests.
 union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
+// Where requests sent as IPC_MSG messages are copied.
+union Fsipc fsmsg;
+
+// Request rings shared with clients (see struct Fsring in inc/fs.h).
+// Ring i's pages are mapped from RINGVA + i * FSRING_NPAGES * PGSIZE.
+#define MAXRING		8
+#define RINGVA		0xE0000000
+
+struct RingClient {
+	envid_t rc_envid;	// client env, or 0 if the slot is free
+	int rc_npages;		// pages of its ring mapped so far
+};
+
+struct RingClient ringtab[MAXRING];
+
+static void *
+ring_page(struct RingClient *rc, int i)
+{
+	return (void *) (RINGVA + ((rc - ringtab) * FSRING_NPAGES + i) * PGSIZE);
+}
+
+// Has rc's client exited?  Its slot may then be reused.
+static bool
+ring_dead(struct RingClient *rc)
+{
+	const volatile struct Env *e = &envs[ENVX(rc->rc_envid)];
+
+	return e->env_id != rc->rc_envid || e->env_status == ENV_FREE;
+}
 
 void
 serve_init(void)
@@ -301,6 +330,159 @@ serve_sync(envid_t envid, union Fsipc *req)
 	return 0;
 }
 
+// Map the request page as the next page of envid's ring.  The header
+// comes first; a client that sends a header again has set up a new
+// ring, e.g. after fork.  Returns the number of pages mapped so far,
+// or < 0 on error.
+int
+serve_ring(envid_t envid, union Fsipc *req)
+{
+	struct RingClient *rc, *free = NULL;
+	int i, r;
+
+	if (debug)
+		cprintf("serve_ring %08x\n", envid);
+
+	if (req != fsreq)
+		return -E_INVAL;
+
+	for (i = 0; i < MAXRING; i++) {
+		rc = &ringtab[i];
+		if (rc->rc_envid && ring_dead(rc))
+			rc->rc_envid = 0;
+		if (rc->rc_envid == envid)
+			break;
+		if (!rc->rc_envid && !free)
+			free = rc;
+	}
+	if (i == MAXRING) {
+		if (!free)
+			return -E_MAX_OPEN;
+		rc = free;
+		rc->rc_envid = envid;
+		rc->rc_npages = 0;
+	} else if (rc->rc_npages == FSRING_NPAGES)
+		rc->rc_npages = 0;
+
+	if ((r = sys_page_map(0, req, 0, ring_page(rc, rc->rc_npages),
+			      PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	return ++rc->rc_npages;
+}
+
+// Carry out one ring request from envid, using buf as its data page.
+// Returns the bytes read or written, or < 0 on error.
+static int
+serve_ring_one(envid_t envid, struct Fsring_sqe *sqe, void *buf)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_ring_one %08x op %d %08x %08x %08x\n", envid,
+			sqe->sqe_op, sqe->sqe_fileid, sqe->sqe_n, sqe->sqe_offset);
+
+	if ((r = openfile_lookup(envid, sqe->sqe_fileid, &o)) < 0)
+		return r;
+	if (sqe->sqe_n > PGSIZE || sqe->sqe_offset < 0)
+		return -E_INVAL;
+
+	switch (sqe->sqe_op) {
+	case FSRING_READ:
+		return file_read(o->o_file, buf, sqe->sqe_n, sqe->sqe_offset);
+	case FSRING_WRITE:
+		return file_write(o->o_file, buf, sqe->sqe_n, sqe->sqe_offset);
+	case FSRING_FLUSH:
+		file_flush(o->o_file);
+		return 0;
+	default:
+		return -E_INVAL;
+	}
+}
+
+// Run the requests queued on rc's ring, in order, and fire the
+// client's event channel if any completed.  A client can't make us
+// loop forever: we take at most one ring's worth per call, and stop
+// early if its completion queue is full.
+static void
+serve_ring_client(struct RingClient *rc)
+{
+	struct Fsring *ring;
+	struct Fsring_sqe sqe;
+	struct Fsring_cqe *cqe;
+	uint32_t slot;
+	int n;
+
+	if (!rc->rc_envid || rc->rc_npages != FSRING_NPAGES)
+		return;
+	if (ring_dead(rc)) {
+		rc->rc_envid = 0;
+		return;
+	}
+
+	ring = ring_page(rc, 0);
+	for (n = 0; n < FSRING_NENTRIES &&
+		     ring->sq_head != ring->sq_tail &&
+		     ring->cq_tail - ring->cq_head < FSRING_NENTRIES; n++) {
+		// Copy the entry so the client can't change it under us.
+		slot = ring->sq_head % FSRING_NENTRIES;
+		sqe = ring->sq[slot];
+		cqe = &ring->cq[ring->cq_tail % FSRING_NENTRIES];
+		cqe->cqe_data = sqe.sqe_data;
+		cqe->cqe_slot = slot;
+		cqe->cqe_res = serve_ring_one(rc->rc_envid, &sqe,
+					      ring_page(rc, 1 + slot));
+
+		// The completion must be complete before the
+		// client can see it.
+		asm volatile("" : : : "memory");
+		ring->sq_head++;
+		ring->cq_tail++;
+	}
+	if (n)
+		sys_event_signal(rc->rc_envid, FSRING_EVTCHAN);
+}
+
+// Someone rang our doorbell, which a client does when our mailbox is
+// too full to post to.  Run the requests queued on every ring.
+static void
+serve_rings(void)
+{
+	struct RingClient *rc;
+
+	for (rc = ringtab; rc < ringtab + MAXRING; rc++)
+		serve_ring_client(rc);
+}
+
+// A client posted FSREQ_RING to say it queued requests on its ring.
+// Take that post and whatever else was posted meanwhile in one
+// sys_ipc_drain, and run the rings of just those clients.
+static void
+serve_posts(envid_t whom, uint32_t req)
+{
+	struct Ipcpost posts[IPC_MBOXSIZE];
+	struct RingClient *rc;
+	int i, n;
+
+	posts[0].ip_from = whom;
+	posts[0].ip_value = req;
+	n = 1 + sys_ipc_drain(posts + 1, IPC_MBOXSIZE - 1);
+
+	for (i = 0; i < n; i++) {
+		if (debug)
+			cprintf("fs post %d from %08x\n",
+				posts[i].ip_value, posts[i].ip_from);
+		if (posts[i].ip_value != FSREQ_RING) {
+			cprintf("Invalid post %d from %08x\n",
+				posts[i].ip_value, posts[i].ip_from);
+			continue;
+		}
+		for (rc = ringtab; rc < ringtab + MAXRING; rc++)
+			if (rc->rc_envid == posts[i].ip_from)
+				serve_ring_client(rc);
+	}
+}
+
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
@@ -311,41 +493,67 @@ fshandler handlers[] = {
 	[FSREQ_FLUSH] =		(fshandler)serve_flush,
 	[FSREQ_WRITE] =		(fshandler)serve_write,
 	[FSREQ_SET_SIZE] =	(fshandler)serve_set_size,
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_RING] =		serve_ring
 };
 
 void
 serve(void)
 {
-	uint32_t req, whom;
-	int perm, r;
-	void *pg;
+	uint32_t req, whom = 0;
+	int perm = 0, r = 0;
+	void *pg = NULL;
+	union Fsipc *args;
 
 	while (1) {
-		perm = 0;
-		req = ipc_recv((int32_t *) &whom, fsreq, &perm);
+		// Reply to the last request, if there is one to answer, and
+		// wait for the next.  Its page replaces the last one at fsreq.
+		req = ipc_reply_recv(whom, r, pg, perm,
+				     (int32_t *) &whom, fsreq, &perm);
+
+		// A doorbell: some client has queued requests on its ring
+		if (whom == 0) {
+			serve_rings();
+			continue;
+		}
+
+		// A post, which carries no page: likewise, but we know whose
+		if (perm == 0) {
+			serve_posts(whom, req);
+			whom = 0;
+			continue;
+		}
+
 		if (debug)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
 				req, whom, uvpt[PGNUM(fsreq)], fsreq);
 
-		// All requests must contain an argument page
-		if (!(perm & PTE_P)) {
+		// All requests must contain an argument page or message
+		if (perm == IPC_MSG) {
+			// The next receive overwrites the message
+			memmove(&fsmsg, (void *) thisenv->env_ipc_msg, IPC_MSGSIZE);
+			args = &fsmsg;
+		} else if (perm & PTE_P) {
+			args = fsreq;
+		} else {
 			cprintf("Invalid request from %08x: no argument page\n",
 				whom);
+			whom = 0;
 			continue; // just leave it hanging...
 		}
 
+		// Only a handler that returns a page sets a reply perm;
+		// the request's (maybe IPC_MSG) must not leak into it.
 		pg = NULL;
+		perm = 0;
 		if (req == FSREQ_OPEN) {
-			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
+			r = serve_open(whom, (struct Fsreq_open*)args, &pg, &perm);
 		} else if (req < ARRAY_SIZE(handlers) && handlers[req]) {
-			r = handlers[req](whom, fsreq);
+			r = handlers[req](whom, args);
 		} else {
 			cprintf("Invalid request code %d from %08x\n", req, whom);
 			r = -E_INVAL;
 		}
-		ipc_send(whom, r, pg, perm);
-		sys_page_unmap(0, fsreq);
 	}
 }
 
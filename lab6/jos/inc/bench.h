@@ -0,0 +1,41 @@
+#ifndef JOS_INC_BENCH_H
+#define JOS_INC_BENCH_H
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+// Microbenchmarks.  Time each run of an operation with the TSC between
+// bench_begin and bench_end, then bench_report prints the distribution
+// of the samples: min, median, 99th percentile and max cycles, the
+// throughput they add up to, and a log2 histogram.
+#define BENCH_MAXSAMPLES	1024
+
+struct Bench {
+	const char *b_name;
+	uint32_t b_n;			// Samples taken
+	uint64_t b_t0;			// TSC at bench_begin
+	uint64_t b_samples[BENCH_MAXSAMPLES];
+};
+
+void	bench_init(struct Bench *b, const char *name);
+void	bench_report(struct Bench *b);
+uint64_t bench_ops_per_sec(uint64_t nops, uint64_t cycles);
+int	bench_ncpu(void);
+
+static inline void
+bench_begin(struct Bench *b)
+{
+	b->b_t0 = read_tsc();
+}
+
+// Samples past BENCH_MAXSAMPLES are dropped.
+static inline void
+bench_end(struct Bench *b)
+{
+	uint64_t t = read_tsc();
+
+	if (b->b_n < BENCH_MAXSAMPLES)
+		b->b_samples[b->b_n++] = t - b->b_t0;
+}
+
+#endif	// !JOS_INC_BENCH_H
@@ -40,6 +40,53 @@ enum {
 	ENV_NOT_RUNNABLE
 };
 
+// Scheduling priorities.  A runnable env of higher priority always
+// runs before one of lower priority.
+enum {
+	ENV_PRIO_LOW = 0,
+	ENV_PRIO_NORMAL,
+	ENV_PRIO_HIGH,
+	NENVPRIO
+};
+
+// env_cpumask value allowing an env to run on any CPU
+#define ENV_CPUMASK_ALL		0xffffffff
+
+// Fair-share weights.  Runnable envs of equal priority get CPU time in
+// proportion to their env_weight.
+#define ENV_WEIGHT_DEFAULT	100
+#define ENV_WEIGHT_MAX		10000
+
+// Small IPC messages.  Passing IPC_MSG as the perm of a send means
+// that srcva points to IPC_MSGSIZE bytes to copy to the receiver
+// rather than a page to map.  The receiver finds them in env_ipc_msg,
+// with env_ipc_perm set to IPC_MSG.
+#define IPC_MSGSIZE		64
+#define IPC_MSG			0x1000
+
+// Posted IPC.  Each env has a mailbox holding up to IPC_MBOXSIZE values
+// posted to it with sys_ipc_post, which sys_ipc_recv and sys_ipc_drain
+// take off in the order they arrived.
+#define IPC_MBOXSIZE		16
+
+struct Ipcpost {
+	envid_t ip_from;		// envid of the poster
+	uint32_t ip_value;		// Value it posted
+};
+
+// Event channels.  Each env has NEVTCHAN channels, channel i being bit
+// i of a mask.  sys_event_bind attaches a channel to a source, which
+// sets the channel's bit when it fires, and sys_event_wait sleeps
+// until one of the bits it asks for is set.
+#define NEVTCHAN		16
+
+enum EvtSource {
+	EVT_NONE = 0,		// Unbound
+	EVT_NET,		// The network card received packets
+	EVT_TIMER,		// time_msec() reached the deadline in arg
+	EVT_ENV,		// Env arg, or any env if 0, signalled us
+};
+
 // Special environment types
 enum EnvType {
 	ENV_TYPE_USER = 0,
@@ -57,6 +104,17 @@ struct Env {
 	uint32_t env_runs;		// Number of times environment has run
 	int env_cpunum;			// The CPU that the env is running on
 
+	// Scheduler state (kern/sched.c)
+	struct Env *env_rq_next;	// Next env on the CPU's run queue
+	struct Env *env_rq_prev;	// Previous env on the CPU's run queue
+	uint64_t env_sched_tsc;		// TSC when the env last left a CPU
+	int env_priority;		// Base scheduling priority
+	int env_eff_priority;		// Priority including IPC inheritance
+	uint32_t env_cpumask;		// Bit i set iff the env may run on CPU i
+	uint32_t env_weight;		// Share of the CPU relative to others
+	uint64_t env_pass;		// Weighted cycles; lowest runs first
+	uint64_t env_cycles;		// TSC cycles spent in user mode
+
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
 
@@ -69,6 +127,34 @@ struct Env {
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	uint8_t env_ipc_msg[IPC_MSGSIZE];	// Message received
+	bool env_ipc_notified;		// Doorbell rung while not receiving
+	envid_t env_ipc_to;		// Env whose answer we await; it
+					// inherits our priority meanwhile
+	envid_t env_ipc_recvfrom;	// If set, only receive from this env
+	bool env_ipc_calling;		// Receive a reply once our send is taken
+	envid_t env_ipc_sendto;		// Env we're blocked sending to
+	uint32_t env_ipc_sendval;	// Value we're blocked sending
+	void *env_ipc_srcva;		// VA of the page we're sending
+	int env_ipc_sendperm;		// Perm to map that page with
+	uint8_t env_ipc_sendmsg[IPC_MSGSIZE];	// Message we're sending
+	struct Env *env_ipc_waiters;	// Envs blocked sending to us
+	struct Env *env_ipc_wnext;	// Next env blocked on env_ipc_sendto
+	struct Env *env_ipc_callers;	// Envs whose calls we have taken
+	struct Env *env_ipc_cnext;	// Next env on env_ipc_callee's list
+	envid_t env_ipc_callee;		// Env whose env_ipc_callers we're on
+	struct Ipcpost env_ipc_mbox[IPC_MBOXSIZE];	// Posted values
+	uint32_t env_ipc_mbox_head;	// Index of the oldest post
+	uint32_t env_ipc_mbox_tail;	// Index past the newest post
+
+	// Event channels (kern/event.c)
+	uint32_t env_evt_pending;	// Channels that have fired
+	uint32_t env_evt_waiting;	// Channels we're blocked waiting on
+	uint8_t env_evt_source[NEVTCHAN];	// What each channel is bound to
+	envid_t env_evt_peer[NEVTCHAN];	// Who may signal an EVT_ENV channel
+	unsigned env_evt_deadline;	// When our timer fires, or 0
+	int env_evt_timerchan;		// Channel our timer fires on
+	struct Env *env_evt_tnext;	// Next env on the armed timer list
 };
 
 struct Snapshot {
@@ -59,7 +59,9 @@ struct Super {
 	struct File s_root;		// Root directory node
 };
 
-// Definitions for requests from clients to file system
+// Definitions for requests from clients to file system.  Each passes
+// a page holding a union Fsipc, except that flush, set-size and sync
+// may pass it as an IPC_MSG message instead.
 enum {
 	FSREQ_OPEN = 1,
 	FSREQ_SET_SIZE,
@@ -70,7 +72,10 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Ring passes one page of the caller's Fsring per request,
+	// header first; returns the number of pages mapped so far
+	FSREQ_RING
 };
 
 union Fsipc {
@@ -113,4 +118,50 @@ union Fsipc {
 	char _pad[PGSIZE];
 };
 
+// Asynchronous requests to the file server.  A client shares a header
+// page holding a submission queue (SQ) and a completion queue (CQ),
+// followed by FSRING_NENTRIES data pages, one for each SQ slot.  The
+// client fills SQ entries and posts FSREQ_RING to the server with
+// sys_ipc_post, or if the server's mailbox is full, rings its doorbell
+// with sys_ipc_notify.  The server drains its mailbox, runs each
+// poster's requests in order, posts a CQ entry for
+// each and fires the client's event channel FSRING_EVTCHAN, so that
+// waiting for completions doesn't swallow the client's other IPC.
+// Each side only writes its own index of each queue.  Indices count
+// up forever; an entry lives at index % FSRING_NENTRIES.
+
+#define FSRING_NENTRIES	16
+#define FSRING_NPAGES	(1 + FSRING_NENTRIES)
+
+// The event channel a ring client reserves for the server's signal.
+#define FSRING_EVTCHAN	15
+
+// Client address of the ring's header page; its data pages follow.
+#define FSRING_VA	0xE0000000
+
+enum {
+	FSRING_READ = 1,	// Read sqe_n bytes at sqe_offset into the data page
+	FSRING_WRITE,		// Write sqe_n bytes from the data page at sqe_offset
+	FSRING_FLUSH		// Flush the file to disk
+};
+
+struct Fsring {
+	volatile uint32_t sq_head;	// Next SQ entry the server takes
+	volatile uint32_t sq_tail;	// Next free SQ entry
+	volatile uint32_t cq_head;	// Next CQ entry the client reaps
+	volatile uint32_t cq_tail;	// Next free CQ entry
+	struct Fsring_sqe {
+		uint32_t sqe_op;	// FSRING_*
+		uint32_t sqe_data;	// Returned untouched in the CQ entry
+		int sqe_fileid;		// File to operate on
+		size_t sqe_n;		// Bytes, at most PGSIZE
+		off_t sqe_offset;	// File offset; the seek position is unused
+	} sq[FSRING_NENTRIES];
+	struct Fsring_cqe {
+		uint32_t cqe_data;	// sqe_data of the request
+		uint32_t cqe_slot;	// SQ slot, and so data page, it used
+		int cqe_res;		// Bytes read or written, or < 0 on error
+	} cq[FSRING_NENTRIES];
+};
+
 #endif /* !JOS_INC_FS_H */
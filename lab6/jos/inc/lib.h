@@ -22,6 +22,7 @@
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
+#include <inc/vsyscall.h>
 
 #define USED(x)		(void)(x)
 
@@ -33,6 +34,7 @@ extern const char *binaryname;
 extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 extern const volatile struct PageInfo pages[];
+extern const volatile struct Vsyscall vsys;
 
 // exit.c
 void	exit(void);
@@ -40,6 +42,12 @@ void	exit(void);
 // pgfault.c
 void	set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
 
+// batch.c
+int	batch_add(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3,
+		  uint32_t a4, uint32_t a5);
+int	batch_flush(void);
+const void *batch_page(void);
+
 // readline.c
 char*	readline(const char *buf);
 
@@ -47,6 +55,7 @@ char*	readline(const char *buf);
 void	sys_cputs(const char *string, size_t len);
 int	sys_cgetc(void);
 envid_t	sys_getenvid(void);
+envid_t	sys_null(void);
 int	sys_env_destroy(envid_t);
 void	sys_yield(void);
 static envid_t sys_exofork(void);
@@ -54,16 +63,31 @@ snapshotid_t sys_env_snapshot(envid_t env);
 int sys_env_resume(envid_t env, snapshotid_t snapshot);
 int	sys_env_set_status(envid_t env, int status);
 int sys_env_set_trapframe(envid_t envid, struct Trapframe *tf);
+int	sys_env_set_priority(envid_t env, int prio);
+int	sys_env_set_affinity(envid_t env, uint32_t cpumask);
+int	sys_env_set_weight(envid_t env, uint32_t weight);
 int	sys_env_set_pgfault_upcall(envid_t env, void *upcall);
 int	sys_page_alloc(envid_t env, void *pg, int perm);
 int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		     void *rcv_pg);
+int	sys_ipc_reply_wait(envid_t to_env, uint32_t value, void *pg, int perm,
+			   void *rcv_pg);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_notify(envid_t env);
+int	sys_ipc_post(envid_t to_env, uint32_t value);
+int	sys_ipc_drain(struct Ipcpost *posts, size_t n);
+int	sys_event_bind(int chan, int source, uint32_t arg);
+int	sys_event_wait(uint32_t mask);
+int	sys_event_signal(envid_t envid, int chan);
 unsigned int sys_time_msec(void);
 int sys_net_transmit(const void* data, uint16_t len);
 int sys_net_recv(void* buf);
+int	sys_batch(struct Syscall *calls, size_t n);
 
 // This must be inlined.  Exercise for reader: why?
 static inline envid_t __attribute__((always_inline))
@@ -79,6 +103,11 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_notify(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		 void *rcv_pg, int *perm_store);
+int32_t ipc_reply_recv(envid_t to_env, uint32_t value, void *pg, int perm,
+		       envid_t *from_env_store, void *rcv_pg, int *perm_store);
 envid_t	ipc_find_env(enum EnvType type);
 
 // fork.c
@@ -103,6 +132,12 @@ int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
 
+// fsring.c
+int	fsring_submit(int op, int fd, void *buf, size_t n, off_t offset,
+		      uint32_t data);
+int	fsring_enter(void);
+int	fsring_reap(struct Fsring_cqe *cqe, bool wait);
+
 // pageref.c
 int	pageref(void *addr);
 
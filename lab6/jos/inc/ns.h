@@ -14,7 +14,8 @@ struct jif_pkt {
 
 // Definitions for requests from clients to network server
 enum {
-	// The following messages pass a page containing an Nsipc.
+	// The following messages pass a page containing an Nsipc, or
+	// for NSREQ_SMALL ones maybe an IPC_MSG message.
 	// Accept returns a Nsret_accept on the request page.
 	NSREQ_ACCEPT = 1,
 	NSREQ_BIND,
@@ -37,6 +38,13 @@ enum {
 	NSREQ_TIMER,
 };
 
+// Requests whose Nsipc fits in an IPC_MSG message, and whose reply is
+// just the result, may be sent that way instead of on a page.
+#define NSREQ_SMALL(req)						\
+	((req) == NSREQ_BIND || (req) == NSREQ_SHUTDOWN ||		\
+	 (req) == NSREQ_CLOSE || (req) == NSREQ_CONNECT ||		\
+	 (req) == NSREQ_LISTEN || (req) == NSREQ_SOCKET)
+
 union Nsipc {
 	struct Nsreq_accept {
 		int req_s;
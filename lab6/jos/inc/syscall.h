@@ -1,6 +1,8 @@
 #ifndef JOS_INC_SYSCALL_H
 #define JOS_INC_SYSCALL_H
 
+#include <inc/types.h>
+
 /* system call numbers */
 enum {
 	SYS_cputs = 0,
@@ -22,7 +24,27 @@ enum {
 	SYS_time_msec,
 	SYS_net_transmit,
 	SYS_net_recv,
+	SYS_env_set_priority,
+	SYS_env_set_affinity,
+	SYS_env_set_weight,
+	SYS_batch,
+	SYS_ipc_notify,
+	SYS_ipc_send,
+	SYS_ipc_call,
+	SYS_ipc_reply_wait,
+	SYS_ipc_post,
+	SYS_ipc_drain,
+	SYS_event_bind,
+	SYS_event_wait,
+	SYS_event_signal,
 	NSYSCALLS
 };
 
+// One system call in a vector passed to sys_batch.
+struct Syscall {
+	uint32_t sc_num;		// System call number
+	uint32_t sc_args[5];		// Its arguments
+	int32_t sc_ret;			// Set to its return value
+};
+
 #endif /* !JOS_INC_SYSCALL_H */
@@ -40,6 +40,7 @@
 #define IRQ_SPURIOUS     7
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_RESCHED     20	// IPI: look at the run queue again
 
 #ifndef __ASSEMBLER__
 
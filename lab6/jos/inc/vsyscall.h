@@ -0,0 +1,18 @@
+#ifndef JOS_INC_VSYSCALL_H
+#define JOS_INC_VSYSCALL_H
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+// The vsyscall page, mapped read-only at UVSYS.  Each CPU has its own,
+// and an env sees the page of the CPU it is running on, so user code
+// can answer getenvid and time queries without entering the kernel.
+struct Vsyscall {
+	envid_t vs_envid;		// The env running on this CPU
+	uint64_t vs_boot_tsc;		// TSC at time 0
+	uint64_t vs_tsc_per_msec;	// TSC ticks per millisecond, 0 until
+					// the kernel has calibrated the TSC
+	bool vs_sysenter;		// Can system calls use sysenter?
+};
+
+#endif /* !JOS_INC_VSYSCALL_H */
@@ -9,6 +9,11 @@
 #include <kern/console.h>
 #include <kern/trap.h>
 #include <kern/picirq.h>
+#include <kern/spinlock.h>
+
+struct spinlock cons_lock = SPINLOCK_INIT(cons_lock);
+// protects the input buffer
+static struct spinlock cons_in_lock = SPINLOCK_INIT(cons_in_lock);
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
@@ -408,9 +413,11 @@ cons_intr(int (*proc)(void))
 	while ((c = (*proc)()) != -1) {
 		if (c == 0)
 			continue;
+		spin_lock(&cons_in_lock);
 		cons.buf[cons.wpos++] = c;
 		if (cons.wpos == CONSBUFSIZE)
 			cons.wpos = 0;
+		spin_unlock(&cons_in_lock);
 	}
 }
 
@@ -427,13 +434,15 @@ cons_getc(void)
 	kbd_intr();
 
 	// grab the next character from the input buffer.
+	c = 0;
+	spin_lock(&cons_in_lock);
 	if (cons.rpos != cons.wpos) {
 		c = cons.buf[cons.rpos++];
 		if (cons.rpos == CONSBUFSIZE)
 			cons.rpos = 0;
-		return c;
 	}
-	return 0;
+	spin_unlock(&cons_in_lock);
+	return c;
 }
 
 // output a character to the console
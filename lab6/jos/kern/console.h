@@ -20,6 +20,10 @@
 void cons_init(void);
 int cons_getc(void);
 
+// Serializes console output, so that lines printed by different CPUs
+// don't interleave.  Held by cprintf().
+extern struct spinlock cons_lock;
+
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
 
@@ -1,6 +1,10 @@
 #include <kern/e1000.h>
 #include <kern/pmap.h>
+#include <kern/spinlock.h>
+#include <kern/picirq.h>
+#include <kern/event.h>
 #include <inc/string.h>
+#include <inc/trap.h>
 #include <inc/error.h>
 
 static void e1000_test_mmio(void);
@@ -17,6 +21,9 @@ uint8_t rx_bufs[E1000_RBS][E1000_NUM_RXDESC];
 
 volatile uint32_t *e1000_mmiobase;
 
+// The 8259A line we take receive interrupts on, or 0 for none.
+int e1000_irq;
+
 // LAB 6: Your driver code here
 int e1000_attach(struct pci_func *pcif)
 {
@@ -103,6 +110,22 @@ int e1000_attach(struct pci_func *pcif)
         rx_desc_queue[i].buffer_addr = PADDR(&rx_bufs[i]);
     }
 
+    // Interrupt when packets arrive, so that the env reading them can
+    // sleep in sys_event_wait.  Every 8259A line has a trap handler, but
+    // trap_dispatch checks ours after the kernel's own devices, so take
+    // the interrupt only on a line none of them uses.
+    if(pcif->irq_line > 0 && pcif->irq_line < MAX_IRQS &&
+       pcif->irq_line != IRQ_SLAVE && pcif->irq_line != IRQ_KBD &&
+       pcif->irq_line != IRQ_SERIAL && pcif->irq_line != IRQ_SPURIOUS)
+    {
+        e1000_irq = pcif->irq_line;
+        e1000_mmiobase[E1000_IMS] = E1000_ICR_RXT0;
+        irq_setmask_8259A(irq_mask_8259A & ~(1<<e1000_irq));
+        evt_net_attach();
+    }
+    else
+        cprintf("e1000: can't use irq %d, receive interrupts off\n", pcif->irq_line);
+
     return 0;
 }
 
@@ -118,7 +141,10 @@ static void e1000_test_mmio(void)
 }
 
 
-int e1000_transmit(const void* data, uint16_t len)
+// Serializes access to the descriptor rings and their tail registers.
+static struct spinlock e1000_lock = SPINLOCK_INIT(e1000_lock);
+
+static int __e1000_transmit(const void* data, uint16_t len)
 {
     // transmit a packet by checking that the next descriptor is free, copying the packet data into the next descriptor, and updating TDT
     unsigned int idx = e1000_mmiobase[E1000_TDT];
@@ -153,6 +179,16 @@ int e1000_transmit(const void* data, uint16_t len)
     }
 }
 
+int e1000_transmit(const void* data, uint16_t len)
+{
+    int r;
+
+    spin_lock(&e1000_lock);
+    r = __e1000_transmit(data, len);
+    spin_unlock(&e1000_lock);
+    return r;
+}
+
 static void e1000_test_transmit(void)
 {
     char buf[] = "this is the new message of the day!\t\n";
@@ -171,7 +207,7 @@ static void e1000_test_transmit(void)
 * returns the length of the data written to buf
 * when an error occured, returns the error code
 */
-int e1000_receive(void* buf)
+static int __e1000_receive(void* buf)
 {
     unsigned int idx = e1000_mmiobase[E1000_RDT];
     // wrap
@@ -199,4 +235,21 @@ int e1000_receive(void* buf)
         // notify the caller
         return - E_RX_EMPTY;
     }
-}
\ No newline at end of file
+}
+
+int e1000_receive(void* buf)
+{
+    int r;
+
+    spin_lock(&e1000_lock);
+    r = __e1000_receive(buf);
+    spin_unlock(&e1000_lock);
+    return r;
+}
+
+// Handle a receive interrupt.  Reading ICR clears it.
+void e1000_intr(void)
+{
+    if(e1000_mmiobase[E1000_ICR] & E1000_ICR_RXT0)
+        evt_net_intr();
+}
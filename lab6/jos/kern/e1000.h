@@ -14,6 +14,8 @@
 
 // MMIO E1000 registers, divided by 4 for use as uint32_t[] indices.
 #define E1000_STATUS   (0x00008/4)  /* Device Status - RO */
+#define E1000_ICR      (0x000C0/4)  /* Interrupt Cause Read - R/clr */
+#define E1000_IMS      (0x000D0/4)  /* Interrupt Mask Set - RW */
 
 #define E1000_TCTL     (0x00400/4)  /* TX Control - RW */
 #define E1000_TCTL_EXT (0x00404/4)  /* Extended TX Control - RW */
@@ -35,6 +37,9 @@
 
 #define E1000_RAH_AV  0x80000000    /* Receive descriptor valid */
 
+/* Interrupt Cause */
+#define E1000_ICR_RXT0 0x00000080   /* rx timer intr (ring 0) */
+
 
 /* Transmit Descriptor bit definitions */
 #define E1000_TXD_CMD_RS     0x00000008 /* Report Status */
@@ -84,8 +89,11 @@ struct e1000_rx_desc {
     uint16_t special;
 };
 
+extern int e1000_irq;
+
 int e1000_attach(struct pci_func *pcif);
 int e1000_transmit(const void* data, uint16_t len);
 int e1000_receive(void* buf);
+void e1000_intr(void);
 
 #endif	// JOS_KERN_E1000_H
@@ -14,11 +14,15 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/sched.h>
-#include <kern/kmalloc.h>
+#include <kern/kmem.h>
+#include <kern/vsyscall.h>
+#include <kern/event.h>
 
 #define debug 0
 
 struct Env *envs = NULL;		// All environments
+int env_nactive;			// Envs runnable, running or dying
+uint32_t env_cpumask_default = ENV_CPUMASK_ALL;	// env_alloc's env_cpumask
 
 #define NSNAPSHOTS 10
 struct Snapshot* snapshots[NSNAPSHOTS];
@@ -27,6 +31,26 @@ struct Snapshot* snapshots[NSNAPSHOTS];
 static struct Env *env_free_list;	// Free environment list
 					// (linked by Env->env_link)
 
+// env_locks[ENVX(envid)] protects that env's address space, trap frame,
+// IPC and page fault state, and keeps it from being freed.  Its
+// scheduling state is protected by the scheduler lock instead.
+static struct spinlock env_locks[NENV];
+// Protects the queues of senders blocked in sys_ipc_send: every env's
+// env_ipc_waiters, env_ipc_wnext and env_ipc_sendto.  An env is only
+// added to a queue with both envs locked, so a receiver holding its
+// own lock knows that its queue can't grow.  Also protects the lists
+// of callers waiting for a reply: env_ipc_callers, env_ipc_cnext and
+// env_ipc_callee.
+static struct spinlock ipc_wait_lock = SPINLOCK_INIT(ipc_wait_lock);
+static struct spinlock env_free_lock = SPINLOCK_INIT(env_free_lock);
+static struct spinlock snapshot_lock = SPINLOCK_INIT(snapshot_lock);
+
+// Object caches for snapshots and the pages they save.
+static struct KmemCache *snapshot_cache;
+static struct KmemCache *savedpage_cache;
+
+static void __snapshot_free(snapshotid_t id);
+
 #define ENVGENSHIFT	12		// >= LOGNENV
 
 // Global descriptor table.
@@ -115,6 +139,260 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	return 0;
 }
 
+void
+env_lock(struct Env *e)
+{
+	spin_lock(&env_locks[e - envs]);
+}
+
+void
+env_unlock(struct Env *e)
+{
+	spin_unlock(&env_locks[e - envs]);
+}
+
+//
+// Like envid2env, but also locks the env on success.
+// Unlock it with env_unlock().
+//
+int
+envid2env_lock(envid_t envid, struct Env **env_store, bool checkperm)
+{
+	struct Env *e = envid ? &envs[ENVX(envid)] : curenv;
+	int r;
+
+	env_lock(e);
+	if ((r = envid2env(envid, env_store, checkperm)) < 0)
+		env_unlock(e);
+	return r;
+}
+
+//
+// Like envid2env_lock, but for two envs at once, which may be the same.
+// They are locked in envs[] order, so that two CPUs locking the same
+// pair can't deadlock.  Unlock them with env_unlock2().
+//
+int
+envid2env_lock2(envid_t envid1, struct Env **env1_store,
+		envid_t envid2, struct Env **env2_store, bool checkperm)
+{
+	struct Env *e1 = envid1 ? &envs[ENVX(envid1)] : curenv;
+	struct Env *e2 = envid2 ? &envs[ENVX(envid2)] : curenv;
+	int r;
+
+	env_lock2(e1, e2);
+	if ((r = envid2env(envid1, env1_store, checkperm)) < 0 ||
+	    (r = envid2env(envid2, env2_store, checkperm)) < 0)
+		env_unlock2(e1, e2);
+	return r;
+}
+
+//
+// Lock two envs, which may be the same, in envs[] order.
+//
+void
+env_lock2(struct Env *e1, struct Env *e2)
+{
+	if (e1 <= e2) {
+		env_lock(e1);
+		if (e2 != e1)
+			env_lock(e2);
+	} else {
+		env_lock(e2);
+		env_lock(e1);
+	}
+}
+
+void
+env_unlock2(struct Env *e1, struct Env *e2)
+{
+	env_unlock(e1);
+	if (e2 != e1)
+		env_unlock(e2);
+}
+
+//
+// Take s off the queue of the env it is blocked sending to, if any.
+// The caller holds ipc_wait_lock.
+//
+static void
+__env_ipc_unwait(struct Env *s)
+{
+	struct Env **pp;
+
+	if (!s->env_ipc_sendto)
+		return;
+	pp = &envs[ENVX(s->env_ipc_sendto)].env_ipc_waiters;
+	while (*pp != s)
+		pp = &(*pp)->env_ipc_wnext;
+	*pp = s->env_ipc_wnext;
+	s->env_ipc_sendto = 0;
+}
+
+//
+// Take s off the list of callers of the env whose reply it awaited, if
+// any.  The caller holds ipc_wait_lock.
+//
+static void
+__env_ipc_uncall(struct Env *s)
+{
+	struct Env **pp;
+
+	if (!s->env_ipc_callee)
+		return;
+	pp = &envs[ENVX(s->env_ipc_callee)].env_ipc_callers;
+	while (*pp != s)
+		pp = &(*pp)->env_ipc_cnext;
+	*pp = s->env_ipc_cnext;
+	s->env_ipc_callee = 0;
+}
+
+//
+// Queue sender s behind any others blocked sending to r.
+// The caller holds both envs' locks.
+//
+void
+env_ipc_wait(struct Env *r, struct Env *s)
+{
+	struct Env **pp;
+
+	spin_lock(&ipc_wait_lock);
+	// s may have been made runnable by hand while queued elsewhere
+	__env_ipc_unwait(s);
+	s->env_ipc_sendto = r->env_id;
+	s->env_ipc_wnext = NULL;
+	for (pp = &r->env_ipc_waiters; *pp; pp = &(*pp)->env_ipc_wnext)
+		/* find the tail */;
+	*pp = s;
+	spin_unlock(&ipc_wait_lock);
+}
+
+//
+// Note that s, blocked in sys_ipc_call, now waits for r's reply, so
+// that s fails if r goes away first.  s stays on r's list after the
+// reply comes, until it calls someone else or either env goes away;
+// env_ipc_detach() skips callers that aren't waiting any more.
+// The caller holds both envs' locks.
+//
+void
+env_ipc_await(struct Env *r, struct Env *s)
+{
+	spin_lock(&ipc_wait_lock);
+	if (s->env_ipc_callee != r->env_id) {
+		__env_ipc_uncall(s);
+		s->env_ipc_callee = r->env_id;
+		s->env_ipc_cnext = r->env_ipc_callers;
+		r->env_ipc_callers = s;
+	}
+	spin_unlock(&ipc_wait_lock);
+}
+
+//
+// Is any sender waiting for r?  r must be locked.
+//
+bool
+env_ipc_pending(struct Env *r)
+{
+	bool pending;
+
+	spin_lock(&ipc_wait_lock);
+	pending = r->env_ipc_waiters != NULL;
+	spin_unlock(&ipc_wait_lock);
+	return pending;
+}
+
+//
+// Take the first sender off r's queue and return it, with both envs
+// locked.  If nobody is waiting, return NULL with just r locked; the
+// queue then stays empty until r is unlocked.
+//
+struct Env *
+env_ipc_take(struct Env *r)
+{
+	struct Env *s;
+
+	while (1) {
+		env_lock(r);
+		spin_lock(&ipc_wait_lock);
+		s = r->env_ipc_waiters;
+		spin_unlock(&ipc_wait_lock);
+		if (!s)
+			return NULL;
+
+		// Lock s in order, and make sure it didn't leave meanwhile.
+		env_unlock(r);
+		env_lock2(r, s);
+		spin_lock(&ipc_wait_lock);
+		if (r->env_ipc_waiters == s) {
+			r->env_ipc_waiters = s->env_ipc_wnext;
+			s->env_ipc_sendto = 0;
+			spin_unlock(&ipc_wait_lock);
+			return s;
+		}
+		spin_unlock(&ipc_wait_lock);
+		env_unlock2(r, s);
+	}
+}
+
+//
+// e is going away: fail the sends and calls of everyone waiting on it,
+// then stop it waiting for anyone.  Each waiter is changed under its
+// own lock.  To take one in envs[] order we may have to drop e's lock
+// for a moment, so a waiter may come or go meanwhile; we go on until
+// both of e's lists are empty with e locked.
+// The caller holds e's lock.
+//
+static void
+env_ipc_detach(struct Env *e)
+{
+	struct Env *s;
+	bool fail;
+
+	while (1) {
+		spin_lock(&ipc_wait_lock);
+		if (!(s = e->env_ipc_waiters))
+			s = e->env_ipc_callers;
+		spin_unlock(&ipc_wait_lock);
+		if (!s)
+			break;
+
+		if (s < e) {
+			env_unlock(e);
+			env_lock2(e, s);
+		} else
+			env_lock(s);
+
+		spin_lock(&ipc_wait_lock);
+		fail = false;
+		if (s->env_ipc_sendto == e->env_id) {
+			__env_ipc_unwait(s);
+			fail = true;
+		} else if (s->env_ipc_callee == e->env_id) {
+			__env_ipc_uncall(s);
+			fail = s->env_ipc_recving &&
+				s->env_ipc_recvfrom == e->env_id;
+		}
+		spin_unlock(&ipc_wait_lock);
+
+		if (fail) {
+			s->env_ipc_recving = 0;
+			s->env_ipc_recvfrom = 0;
+			s->env_ipc_calling = 0;
+			s->env_tf.tf_regs.reg_eax = -E_BAD_ENV;
+			env_set_status(s, ENV_RUNNABLE);
+		}
+		env_unlock(s);
+	}
+
+	spin_lock(&ipc_wait_lock);
+	__env_ipc_unwait(e);
+	__env_ipc_uncall(e);
+	spin_unlock(&ipc_wait_lock);
+	e->env_ipc_recving = 0;
+	e->env_ipc_recvfrom = 0;
+	e->env_ipc_calling = 0;
+}
+
 // Mark all environments in 'envs' as free, set their env_ids to 0,
 // and insert them into the env_free_list.
 // Make sure the environments are in the free list in the same order
@@ -131,6 +409,14 @@ env_init(void)
 	struct Env *p_env;
 	int i;
 	
+	for(i=0; i<NENV; ++i)
+		__spin_initlock(&env_locks[i], "env_lock");
+
+	snapshot_cache = kmem_cache_create("snapshot", sizeof(struct Snapshot));
+	savedpage_cache = kmem_cache_create("savedpage", sizeof(struct SavedPage));
+	if (!snapshot_cache || !savedpage_cache)
+		panic("env_init: cannot create the snapshot caches");
+
 	env_free_list = &envs[0];
 	p_env = env_free_list;
 
@@ -232,12 +518,21 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	int r;
 	struct Env *e;
 
-	if (!(e = env_free_list))
+	spin_lock(&env_free_lock);
+	if ((e = env_free_list))
+		env_free_list = e->env_link;
+	spin_unlock(&env_free_lock);
+	if (!e)
 		return -E_NO_FREE_ENV;
 
 	// Allocate and set up the page directory for this environment.
-	if ((r = env_setup_vm(e)) < 0)
+	if ((r = env_setup_vm(e)) < 0) {
+		spin_lock(&env_free_lock);
+		e->env_link = env_free_list;
+		env_free_list = e;
+		spin_unlock(&env_free_lock);
 		return r;
+	}
 
 	// Generate an env_id for this environment.
 	generation = (e->env_id + (1 << ENVGENSHIFT)) & ~(NENV - 1);
@@ -248,8 +543,25 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
 	e->env_type = ENV_TYPE_USER;
-	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	e->env_cpunum = cpunum();
+	e->env_priority = e->env_eff_priority = ENV_PRIO_NORMAL;
+	e->env_cpumask = env_cpumask_default;
+	e->env_weight = ENV_WEIGHT_DEFAULT;
+	e->env_pass = 0;
+	e->env_cycles = 0;
+	e->env_ipc_to = 0;
+	e->env_ipc_notified = 0;
+	e->env_ipc_recvfrom = 0;
+	e->env_ipc_calling = 0;
+	e->env_ipc_sendto = 0;
+	e->env_ipc_waiters = NULL;
+	e->env_ipc_callers = NULL;
+	e->env_ipc_callee = 0;
+	e->env_ipc_mbox_head = e->env_ipc_mbox_tail = 0;
+	e->env_evt_pending = e->env_evt_waiting = 0;
+	memset(e->env_evt_source, EVT_NONE, sizeof(e->env_evt_source));
+	e->env_evt_deadline = 0;
 
 	// Clear out all the saved register state,
 	// to prevent the register values
@@ -276,8 +588,9 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	
 	// You will set e->env_tf.tf_eip later.
 
-	// commit the allocation
-	env_free_list = e->env_link;
+	// commit the allocation.  The new env is not runnable until
+	// its creator has finished setting it up.
+	env_set_status(e, ENV_NOT_RUNNABLE);
 	*newenv_store = e;
 	
 	if(debug)
@@ -414,8 +727,9 @@ load_icode(struct Env *e, uint8_t *binary)
 // This function is ONLY called during kernel initialization,
 // before running the first user-mode environment.
 // The new env's parent ID is set to 0.
+// Returns the new env.
 //
-void
+struct Env *
 env_create(uint8_t *binary, enum EnvType type)
 {
 	// LAB 3: Your code here.
@@ -430,6 +744,9 @@ env_create(uint8_t *binary, enum EnvType type)
 	if(type == ENV_TYPE_FS)
 		e->env_tf.tf_eflags |= FL_IOPL_MASK;
 	e->env_type = type;
+
+	env_set_status(e, ENV_RUNNABLE);
+	return e;
 }
 
 void
@@ -460,12 +777,12 @@ env_flush_addr_space(struct Env *e)
 		e->env_pgdir[pdeno] = 0;
 		page_decref(pa2page(pa));
 	}
-
-	e->env_status = ENV_NOT_RUNNABLE;
 }
 
 //
 // Frees env e and all memory it uses.
+// The caller holds e's lock, and no other CPU may have e loaded.
+// If e is the current environment, curenv becomes NULL.
 //
 void
 env_free(struct Env *e)
@@ -473,24 +790,30 @@ env_free(struct Env *e)
 	int i;
 	physaddr_t pa;
 
+	// Note the environment's demise
+	if(debug)
+		cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+
 	// If freeing the current environment, switch to kern_pgdir
 	// before freeing the page directory, just in case the page
 	// gets reused.
-	if (e == curenv)
+	if (e == curenv) {
+		sched_lock();
+		curenv = NULL;
 		lcr3(PADDR(kern_pgdir));
-
-	// Note the environment's demise
-	if(debug)
-		cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+		sched_unlock();
+	}
 
 	// Flush all snapshots associated with the env
+	spin_lock(&snapshot_lock);
 	for(i=0; i<NSNAPSHOTS; ++i)
 	{
 		if(snapshots[i] && snapshots[i]->envid == e->env_id)
 		{
-			snapshot_free(i);
+			__snapshot_free(i);
 		}
 	}
+	spin_unlock(&snapshot_lock);
 
 	// Flush all mapped pages in the user portion of the address space
 	static_assert(UTOP % PTSIZE == 0);
@@ -502,30 +825,91 @@ env_free(struct Env *e)
 	page_decref(pa2page(pa));
 
 	// return the environment to the free list
-	e->env_status = ENV_FREE;
+	env_set_status(e, ENV_FREE);
+	spin_lock(&env_free_lock);
 	e->env_link = env_free_list;
 	env_free_list = e;
+	spin_unlock(&env_free_lock);
 }
 
 //
 // Frees environment e.
+// The caller holds e's lock.  If e is the current environment, this
+// releases the lock and does not return.
 //
 void
 env_destroy(struct Env *e)
 {
-	if (e->env_status == ENV_RUNNING && curenv != e) {
-		e->env_status = ENV_DYING;
+	// Before anything else, so that no receiver can wake e up
+	// while it is being freed.
+	env_ipc_detach(e);
+	evt_timer_disarm(e, e->env_evt_timerchan);
+
+	// An env that another CPU has loaded is freed by that CPU, once
+	// it has switched away from it (see sched_unload()).
+	sched_lock();
+	if (e->env_status == ENV_DYING ||
+	    (e != curenv && sched_loaded_elsewhere(e))) {
+		__env_set_status(e, ENV_DYING);
+		sched_unlock();
+		return;
+	}
+	// nobody may pick e up while we free it
+	__env_set_status(e, ENV_NOT_RUNNABLE);
+	sched_unlock();
+
+	if (e != curenv) {
+		env_free(e);
 		return;
 	}
 
 	env_free(e);
+	env_unlock(e);
+	sched_yield();
+}
 
-	if (curenv == e) {
-		curenv = NULL;
-		sched_yield();
-	}
+//
+// Change e's status, keeping the scheduler in sync: an env sits on a
+// run queue exactly when it is ENV_RUNNABLE.
+//
+void
+env_set_status(struct Env *e, unsigned status)
+{
+	sched_lock();
+	__env_set_status(e, status);
+	sched_unlock();
 }
 
+//
+// The same, for callers already holding the scheduler lock.
+// A dying env stays dying until it is freed.
+//
+void
+__env_set_status(struct Env *e, unsigned status)
+{
+	unsigned old = e->env_status;
+
+	if (old == status || (old == ENV_DYING && status != ENV_FREE))
+		return;
+
+	if (old == ENV_RUNNABLE)
+		sched_dequeue(e);
+	if (old == ENV_RUNNING) {
+		e->env_sched_tsc = read_tsc();
+		// e is running on another CPU, which has to notice
+		sched_kick(e->env_cpunum);
+	}
+
+	if (old == ENV_RUNNABLE || old == ENV_RUNNING || old == ENV_DYING)
+		env_nactive--;
+	if (status == ENV_RUNNABLE || status == ENV_RUNNING || status == ENV_DYING)
+		env_nactive++;
+
+	e->env_status = status;
+
+	if (status == ENV_RUNNABLE)
+		sched_enqueue(e);
+}
 
 //
 // Restores the register values in the Trapframe with the 'iret' instruction.
@@ -550,6 +934,7 @@ env_pop_tf(struct Trapframe *tf)
 //
 // Context switch from curenv to env e.
 // Note: if this is the first call to env_run, curenv is NULL.
+// The caller holds the scheduler lock, which this releases.
 //
 // This function does not return.
 //
@@ -576,19 +961,37 @@ env_run(struct Env *e)
 	// LAB 3: Your code here.
 	// panic("env_run not yet implemented");
 
-	if (curenv != e)
+	struct Env *old = curenv;
+	bool dying;
+
+	if (old != e)
 	{
-		if(curenv && curenv->env_status == ENV_RUNNING)
-			curenv->env_status = ENV_RUNNABLE;
+		if(old && old->env_status == ENV_RUNNING)
+			__env_set_status(old, ENV_RUNNABLE);
 
 		curenv = e;
 		++ e->env_runs;
-		e->env_status = ENV_RUNNING;
 	}
 
-	unlock_kernel();
+	// e may still be queued if it made itself runnable
+	__env_set_status(e, ENV_RUNNING);
+	sched_migrate(e, cpunum());
+	sched_set_timer();
+	vsys_load(e);
 
+	// Leave old's address space before anyone can free it.
 	lcr3(PADDR(e->env_pgdir));
+	dying = old && old != e && sched_unload(old);
+	sched_unlock();
+
+	// Nobody else frees a dying env while a CPU still has it loaded.
+	if (dying) {
+		env_lock(old);
+		env_free(old);
+		env_unlock(old);
+	}
+
+	thiscpu->cpu_run_tsc = read_tsc();
 	env_pop_tf(&e->env_tf);
 }
 
@@ -597,31 +1000,72 @@ env_run(struct Env *e)
 // --------------------------------------------------------------
 // Snapshot functions
 // --------------------------------------------------------------
-struct Snapshot* id2snapshot(snapshotid_t id)
+// Snapshots are owned by the env they were taken of; the owner's lock
+// keeps them from being freed, snapshot_lock protects snapshots[].
+
+// Returns snapshot 'id' if it belongs to env 'envid', NULL otherwise.
+struct Snapshot* id2snapshot(snapshotid_t id, envid_t envid)
 {
+	struct Snapshot *ss;
+
 	if(id >= NSNAPSHOTS || id < 0)
 		return NULL;
 
-	return snapshots[id];
+	spin_lock(&snapshot_lock);
+	ss = snapshots[id];
+	if(ss && ss->envid != envid)
+		ss = NULL;
+	spin_unlock(&snapshot_lock);
+	return ss;
 }
 
-int snapshot_alloc(snapshotid_t* id_store)
+int snapshot_alloc(snapshotid_t* id_store, envid_t envid)
 {
+	struct Snapshot *ss;
 	int i;
+
+	if(!(ss = (struct Snapshot*) kmem_cache_alloc(snapshot_cache)))
+		return -E_NO_MEM;
+	ss->envid = envid;
+	ss->saved_pages = NULL;
+
+	spin_lock(&snapshot_lock);
 	for(i=0; i<NSNAPSHOTS; ++i)
 	{
 		if(!snapshots[i])
 		{
-			snapshots[i] = (struct Snapshot*) kmalloc(sizeof(struct Snapshot));
+			snapshots[i] = ss;
+			spin_unlock(&snapshot_lock);
 			*id_store = i;
 
 			return 0;
 		}
 	}
+	spin_unlock(&snapshot_lock);
 
+	kmem_cache_free(snapshot_cache, ss);
 	return -E_NO_MEM;
 }
 
+// Allocate a SavedPage with no page and no successor.
+// Returns NULL if out of memory.
+struct SavedPage* savedpage_alloc(void)
+{
+	struct SavedPage *sp;
+
+	if(!(sp = (struct SavedPage*) kmem_cache_alloc(savedpage_cache)))
+		return NULL;
+	sp->saved_page = NULL;
+	sp->next = NULL;
+	return sp;
+}
+
+// Free one SavedPage, but not the page it saved.
+void savedpage_free(struct SavedPage* sp)
+{
+	kmem_cache_free(savedpage_cache, sp);
+}
+
 void _savedpages_free(struct SavedPage* cur)
 {
 	struct SavedPage *temp;
@@ -631,12 +1075,13 @@ void _savedpages_free(struct SavedPage* cur)
 		temp = cur->next;
 		if(cur->saved_page)
 			page_free(cur->saved_page);
-		kfree(cur);
+		savedpage_free(cur);
 		cur = temp;
 	}
 }
 
-void snapshot_free(snapshotid_t id)
+// The caller holds snapshot_lock.
+static void __snapshot_free(snapshotid_t id)
 {
 	if(id >= NSNAPSHOTS || id < 0)
 		return;
@@ -645,7 +1090,14 @@ void snapshot_free(snapshotid_t id)
 		return;
 
 	_savedpages_free(snapshots[id]->saved_pages);
-	kfree(snapshots[id]);
+	kmem_cache_free(snapshot_cache, snapshots[id]);
 
 	snapshots[id] = NULL;
+}
+
+void snapshot_free(snapshotid_t id)
+{
+	spin_lock(&snapshot_lock);
+	__snapshot_free(id);
+	spin_unlock(&snapshot_lock);
 }
\ No newline at end of file
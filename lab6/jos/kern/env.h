@@ -7,6 +7,8 @@
 #include <kern/cpu.h>
 
 extern struct Env *envs;		// All environments
+extern int env_nactive;			// Envs runnable, running or dying
+extern uint32_t env_cpumask_default;	// CPUs a new env may use
 
 //extern struct Env *curenv;		// Current environment
 #define curenv (thiscpu->cpu_env) // The current env
@@ -17,29 +19,46 @@ void	env_init_percpu(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
 void    env_flush_addr_space(struct Env *e);
 void	env_free(struct Env *e);
-void	env_create(uint8_t *binary, enum EnvType type);
+struct Env *env_create(uint8_t *binary, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
+void	env_set_status(struct Env *e, unsigned status);
+void	__env_set_status(struct Env *e, unsigned status);
 
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
+int	envid2env_lock(envid_t envid, struct Env **env_store, bool checkperm);
+int	envid2env_lock2(envid_t envid1, struct Env **env1_store,
+			envid_t envid2, struct Env **env2_store, bool checkperm);
+void	env_lock(struct Env *e);
+void	env_unlock(struct Env *e);
+void	env_lock2(struct Env *e1, struct Env *e2);
+void	env_unlock2(struct Env *e1, struct Env *e2);
+void	env_ipc_wait(struct Env *r, struct Env *s);
+void	env_ipc_await(struct Env *r, struct Env *s);
+bool	env_ipc_pending(struct Env *r);
+struct Env *env_ipc_take(struct Env *r);
 // The following two functions do not return
 void	env_run(struct Env *e) __attribute__((noreturn));
 void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
 
 
-struct Snapshot* id2snapshot(snapshotid_t id);
-int snapshot_alloc(snapshotid_t* id_store);
+struct Snapshot* id2snapshot(snapshotid_t id, envid_t envid);
+int snapshot_alloc(snapshotid_t* id_store, envid_t envid);
 void snapshot_free(snapshotid_t id);
+struct SavedPage* savedpage_alloc(void);
+void savedpage_free(struct SavedPage* sp);
+void _savedpages_free(struct SavedPage* cur);
 
 // Without this extra macro, we couldn't pass macros like TEST to
 // ENV_CREATE because of the C pre-processor's argument prescan rule.
 #define ENV_PASTE3(x, y, z) x ## y ## z
 
+// Evaluates to the new struct Env *.
 #define ENV_CREATE(x, type)						\
-	do {								\
+	({								\
 		extern uint8_t ENV_PASTE3(_binary_obj_, x, _start)[];	\
 		env_create(ENV_PASTE3(_binary_obj_, x, _start),		\
 			   type);					\
-	} while (0)
+	})
 
 #endif // !JOS_KERN_ENV_H
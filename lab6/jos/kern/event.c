@@ -0,0 +1,220 @@
+// Event channels.
+//
+// An env binds each of its NEVTCHAN channels to at most one source:
+// the network card's receive interrupt, a timer deadline, or
+// sys_event_signal from another env.  When the source fires, it sets
+// the channel's bit in env_evt_pending, and if the env is blocked in
+// sys_event_wait on that bit, makes it runnable.  A bit set while
+// nobody is waiting stays set until the next sys_event_wait, so an
+// event can't be lost between checking for work and going to sleep.
+//
+// env_evt_pending and env_evt_waiting are protected by the env's lock.
+// The network binding and every env's timer are protected by evt_lock,
+// which nests inside env locks; sources drop it before raising.
+//
+// Armed timers sit on evt_timers, soonest first, so a timer interrupt
+// looks only at the timers that are due.  An env is on the list exactly
+// when its env_evt_deadline is nonzero.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/sched.h>
+#include <kern/spinlock.h>
+#include <kern/time.h>
+#include <kern/event.h>
+
+static struct spinlock evt_lock = SPINLOCK_INIT(evt_lock);
+
+// The one env bound to the network card's receive interrupt, if any.
+static bool evt_net_ok;
+static envid_t evt_net_env;
+static int evt_net_chan;
+
+// Envs with an armed timer, by env_evt_deadline, linked through
+// env_evt_tnext.
+static struct Env *evt_timers;
+
+// The earliest env_evt_deadline of any env, or ~0 if none is armed.
+// The boot CPU keeps its timer armed for it.
+static unsigned evt_next_deadline = ~0;
+
+// A scheduler tick is 10ms; see time_init().
+#define EVT_MSEC_PER_TICK	10
+
+// Fire channel chan of e.  The caller holds e's lock.
+void
+__evt_raise(struct Env *e, int chan)
+{
+	uint32_t fired;
+
+	e->env_evt_pending |= 1 << chan;
+	fired = e->env_evt_pending & e->env_evt_waiting;
+	if (fired && e->env_status == ENV_NOT_RUNNABLE) {
+		e->env_evt_pending &= ~fired;
+		e->env_evt_waiting = 0;
+		e->env_tf.tf_regs.reg_eax = fired;
+		env_set_status(e, ENV_RUNNABLE);
+	}
+}
+
+// Fire channel chan of envid, if it still exists.  May be called from
+// an interrupt, with no env running on this CPU.
+void
+evt_raise(envid_t envid, int chan)
+{
+	struct Env *e;
+
+	if (envid == 0 || envid2env_lock(envid, &e, 0) < 0)
+		return;
+	__evt_raise(e, chan);
+	env_unlock(e);
+}
+
+// The network card interrupts us when it receives packets.
+void
+evt_net_attach(void)
+{
+	evt_net_ok = true;
+}
+
+// Bind the network card's receive interrupt to channel chan of envid.
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_SUPP if the card doesn't interrupt us.
+//	-E_INVAL if another live env has it bound.
+int
+evt_net_bind(envid_t envid, int chan)
+{
+	struct Env *e;
+	int r = 0;
+
+	if (!evt_net_ok)
+		return -E_NOT_SUPP;
+	spin_lock(&evt_lock);
+	if (evt_net_env && evt_net_env != envid &&
+	    envid2env(evt_net_env, &e, 0) >= 0)
+		r = -E_INVAL;
+	else {
+		evt_net_env = envid;
+		evt_net_chan = chan;
+	}
+	spin_unlock(&evt_lock);
+	return r;
+}
+
+// Unbind the network card's interrupt, if envid has it bound.
+void
+evt_net_unbind(envid_t envid)
+{
+	spin_lock(&evt_lock);
+	if (evt_net_env == envid)
+		evt_net_env = 0;
+	spin_unlock(&evt_lock);
+}
+
+// The network card received packets.
+void
+evt_net_intr(void)
+{
+	envid_t envid;
+	int chan;
+
+	spin_lock(&evt_lock);
+	envid = evt_net_env;
+	chan = evt_net_chan;
+	spin_unlock(&evt_lock);
+	evt_raise(envid, chan);
+}
+
+// Take e off evt_timers, if it is on it.  The caller holds evt_lock.
+static void
+evt_timer_unlink(struct Env *e)
+{
+	struct Env **pp;
+
+	if (!e->env_evt_deadline)
+		return;
+	for (pp = &evt_timers; *pp != e; pp = &(*pp)->env_evt_tnext)
+		assert(*pp);
+	*pp = e->env_evt_tnext;
+	e->env_evt_deadline = 0;
+	evt_next_deadline = evt_timers ? evt_timers->env_evt_deadline : ~0;
+}
+
+// Arm e's timer to fire channel chan once time_msec() reaches
+// deadline, replacing any deadline it had.  deadline must not be 0.
+void
+evt_timer_arm(struct Env *e, int chan, unsigned deadline)
+{
+	struct Env **pp;
+	bool kick;
+
+	spin_lock(&evt_lock);
+	evt_timer_unlink(e);
+	e->env_evt_deadline = deadline;
+	e->env_evt_timerchan = chan;
+	for (pp = &evt_timers; *pp; pp = &(*pp)->env_evt_tnext)
+		if ((*pp)->env_evt_deadline > deadline)
+			break;
+	e->env_evt_tnext = *pp;
+	*pp = e;
+	kick = deadline < evt_next_deadline;
+	if (kick)
+		evt_next_deadline = deadline;
+	spin_unlock(&evt_lock);
+
+	// Have the boot CPU set its timer for the new deadline.
+	if (kick)
+		sched_kick(bootcpu->cpu_id);
+}
+
+// Disarm e's timer if it is set to fire channel chan.
+void
+evt_timer_disarm(struct Env *e, int chan)
+{
+	spin_lock(&evt_lock);
+	if (e->env_evt_timerchan == chan)
+		evt_timer_unlink(e);
+	spin_unlock(&evt_lock);
+}
+
+// Fire every timer whose deadline has passed.  Called on each timer
+// interrupt; cheap when nothing is due.
+void
+evt_timer_check(void)
+{
+	unsigned now = time_msec();
+	envid_t envid;
+	int chan;
+	struct Env *e;
+
+	while (evt_next_deadline <= now) {
+		envid = 0;
+		spin_lock(&evt_lock);
+		if ((e = evt_timers) && e->env_evt_deadline <= now) {
+			envid = e->env_id;
+			chan = e->env_evt_timerchan;
+			evt_timer_unlink(e);
+		}
+		spin_unlock(&evt_lock);
+		if (!envid)
+			break;
+		evt_raise(envid, chan);
+	}
+}
+
+// Return the number of ticks until the earliest timer is due, for the
+// boot CPU to set its timer with, or 0 if no timer is armed.
+uint32_t
+evt_timer_ticks(void)
+{
+	unsigned deadline = evt_next_deadline, now = time_msec();
+
+	if (deadline == ~0U)
+		return 0;
+	if (deadline <= now)
+		return 1;
+	return (deadline - now + EVT_MSEC_PER_TICK - 1) / EVT_MSEC_PER_TICK;
+}
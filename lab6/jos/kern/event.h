@@ -0,0 +1,23 @@
+#ifndef JOS_KERN_EVENT_H
+#define JOS_KERN_EVENT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+void __evt_raise(struct Env *e, int chan);
+void evt_raise(envid_t envid, int chan);
+
+void evt_net_attach(void);
+int evt_net_bind(envid_t envid, int chan);
+void evt_net_unbind(envid_t envid);
+void evt_net_intr(void);
+
+void evt_timer_arm(struct Env *e, int chan, unsigned deadline);
+void evt_timer_disarm(struct Env *e, int chan);
+void evt_timer_check(void);
+uint32_t evt_timer_ticks(void);
+
+#endif /* !JOS_KERN_EVENT_H */
@@ -3,6 +3,7 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
@@ -16,14 +17,22 @@
 #include <kern/spinlock.h>
 #include <kern/time.h>
 #include <kern/pci.h>
+#include <kern/vsyscall.h>
 
 static void boot_aps(void);
 
+// Set once i386_init has created the initial envs.  Until then the APs
+// wait in mp_main, since with nothing to run they would drop into the
+// monitor.
+static volatile uint32_t aps_may_run;
+
 
 void
 i386_init(void)
 {
 	extern char edata[], end[];
+	struct Env *fs, *ns;
+	uint32_t reserved;
 
 	// Before doing anything else, complete the ELF loading process.
 	// Clear the uninitialized global data (BSS) section of our program.
@@ -41,6 +50,7 @@ i386_init(void)
 
 	// Lab 3 user environment initialization functions
 	env_init();
+	vsys_init();
 	trap_init();
 
 	// Lab 4 multiprocessor initialization functions
@@ -54,21 +64,43 @@ i386_init(void)
 	time_init();
 	pci_init();
 
-	// Acquire the big kernel lock before waking up APs
-	// Your code here:
-	// Acquire the big kernel lock before waking up APs
-	// Your code here:
-	lock_kernel();
-
 	// Starting non-boot CPUs
 	boot_aps();
 
+	// The servers run at high priority, so that their clients'
+	// requests don't wait behind CPU hogs.  With CPUs to spare, they
+	// get cores of their own, so their caches stay warm: the file
+	// system server the last CPU and the network server the one
+	// before.  The network server places its helper envs itself:
+	// ns_input on the CPU below it, ns_output and ns_timer beside it.
+	// Every other env the kernel creates, and so everything forked
+	// from those, starts out kept off these cores.
+	if (ncpu >= 4) {
+		reserved = 1 << (ncpu - 1);
+#if !defined(TEST_NO_NS)
+		reserved |= 3 << (ncpu - 3);
+#endif
+		env_cpumask_default = ENV_CPUMASK_ALL & ~reserved;
+	}
+
 	// Start fs.
-	ENV_CREATE(fs_fs, ENV_TYPE_FS);
+	fs = ENV_CREATE(fs_fs, ENV_TYPE_FS);
+	sched_lock();
+	fs->env_priority = ENV_PRIO_HIGH;
+	sched_set_priority(fs, ENV_PRIO_HIGH);
+	if (ncpu >= 4)
+		sched_set_affinity(fs, 1 << (ncpu - 1));
+	sched_unlock();
 
 #if !defined(TEST_NO_NS)
 	// Start ns.
-	ENV_CREATE(net_ns, ENV_TYPE_NS);
+	ns = ENV_CREATE(net_ns, ENV_TYPE_NS);
+	sched_lock();
+	ns->env_priority = ENV_PRIO_HIGH;
+	sched_set_priority(ns, ENV_PRIO_HIGH);
+	if (ncpu >= 4)
+		sched_set_affinity(ns, 1 << (ncpu - 2));
+	sched_unlock();
 #endif
 
 #if defined(TEST)
@@ -84,6 +116,9 @@ i386_init(void)
 	// Should not be necessary - drains keyboard because interrupt has given up.
 	kbd_intr();
 
+	// Let the APs into the scheduler too.
+	xchg(&aps_may_run, 1);
+
 	// Schedule and run the first user environment!
 	sched_yield();
 }
@@ -136,13 +171,12 @@ mp_main(void)
 	xchg(&thiscpu->cpu_status, CPU_STARTED); // tell boot_aps() we're up
 
 	// Now that we have finished some basic setup, call sched_yield()
-	// to start running processes on this CPU.  But make sure that
-	// only one CPU can enter the scheduler at a time!
-	//
-	// Your code here:
-	lock_kernel();
+	// to start running processes on this CPU.
+
+	// Wait until the BSP has created the initial envs.
+	while (!aps_may_run)
+		asm volatile("pause");
 
-	// Remove this after you finish Exercise 6
 	sched_yield();
 }
 
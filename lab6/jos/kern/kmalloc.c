@@ -2,19 +2,25 @@
 #include <inc/memlayout.h>
 #include <inc/assert.h>
 #include <kern/pmap.h>
+#include <kern/spinlock.h>
+#include <kern/kmalloc.h>
 #include <inc/x86.h>
 #include <inc/types.h>
 
 // kernel virtual memory allocator
 
-// fixed kernel heap for dynamic memory allocation
-// does not make use of page_alloc for simplicity
+// The heap grows in arenas: blocks of 2^order physically contiguous
+// pages from page_alloc_order, addressed through the mapping of all
+// physical memory at KERNBASE, so growing needs no new page tables and
+// shrinking no TLB shootdowns.  An arena that becomes entirely free
+// goes back to the page allocator.
+#define KHEAP_MINORDER	2
 
-// mapped to vm UHEAP in kernel address space
-char kheap[KHEAPSIZE]
-__attribute__ ((aligned(PGSIZE)));
+uint32_t kheap_narenas;		// Arenas held now
+uint32_t kheap_npages;		// Pages in those arenas
 
-static uintptr_t kheaptop = (uintptr_t) kheap;
+// protects the free list, the arena list and the counters
+static struct spinlock kmalloc_lock = SPINLOCK_INIT(kmalloc_lock);
 
 
 // Memory allocation routines to support allocations with finer granularity
@@ -38,7 +44,13 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
-static void
+// Every arena starts with a header unit that is never free, so that
+// free blocks in neighbouring arenas can't coalesce.  These headers
+// are linked through s.ptr, and s.size is the arena's size in units.
+static Header *arenas;
+
+// Returns the free block that ap ended up in.
+static Header*
 _free(void *ap)
 {
   Header *bp, *p;
@@ -52,36 +64,79 @@ _free(void *ap)
     bp->s.ptr = p->s.ptr->s.ptr;
   } else
     bp->s.ptr = p->s.ptr;
+  freep = p;
   if(p + p->s.size == bp){
     p->s.size += bp->s.size;
     p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+    return p;
+  }
+  p->s.ptr = bp;
+  return bp;
 }
 
 #define NALLOC 1024
 
 static Header*
-morecore(void* (sbrk)(intptr_t), uint32_t nu)
+morecore(uint32_t nu)
 {
-  char *p;
-  Header *hp;
+  struct PageInfo *pp;
+  Header *ap, *hp;
+  int order;
 
   if(nu < NALLOC)
     nu = NALLOC;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  // one extra unit for the arena header
+  for(order = KHEAP_MINORDER; (PGSIZE << order) / sizeof(Header) < nu + 1; order++)
+    if(order == PAGE_MAX_ORDER)
+      return 0;
+  if(!(pp = page_alloc_order(order, 0)))
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
+
+  ap = (Header*)page2kva(pp);
+  ap->s.size = (PGSIZE << order) / sizeof(Header);
+  ap->s.ptr = arenas;
+  arenas = ap;
+  kheap_narenas++;
+  kheap_npages += 1 << order;
+
+  hp = ap + 1;
+  hp->s.size = ap->s.size - 1;
   _free((void*)(hp + 1));
 
   return freep;
 }
 
+// If bp, a free block, is all of an arena, return the arena to
+// the page allocator.
+static void
+kheap_release(Header *bp)
+{
+  Header *a, **ap, *p;
+  int order;
+
+  if((uintptr_t)(bp - 1) % PGSIZE)
+    return;
+  for(ap = &arenas; (a = *ap); ap = &a->s.ptr)
+    if(a == bp - 1)
+      break;
+  if(!a || bp->s.size != a->s.size - 1)
+    return;
+
+  for(p = freep; p->s.ptr != bp; p = p->s.ptr)
+    ;
+  p->s.ptr = bp->s.ptr;
+  freep = p;
+  *ap = a->s.ptr;
+
+  for(order = 0; (PGSIZE << order) / sizeof(Header) < a->s.size; order++)
+    ;
+  kheap_narenas--;
+  kheap_npages -= 1 << order;
+  page_free_order(pa2page(PADDR(a)), order);
+}
+
 static void*
-_malloc(void* (sbrk)(intptr_t), uint32_t nbytes)
+_malloc(uint32_t nbytes)
 {
   Header *p, *prevp;
   uint32_t nunits;
@@ -104,27 +159,25 @@ _malloc(void* (sbrk)(intptr_t), uint32_t nbytes)
       return (void*)(p + 1);
     }
     if(p == freep)
-      if((p = morecore(sbrk, nunits)) == 0)
+      if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
 
-static void* kheap_sbrk(intptr_t nbytes)
-{
-    uintptr_t ret = kheaptop;
-    if(kheaptop + nbytes < (uintptr_t) kheap || kheaptop + nbytes >= (uintptr_t) kheap + KHEAPSIZE)
-        panic("kheap_sbrk: allocation out of bounds\n");
-    
-    kheaptop += nbytes;
-    return (void*)ret;
-}
-
+// Returns NULL if out of memory.
 void* kmalloc(uint32_t nbytes)
 {
-    return _malloc(kheap_sbrk, nbytes);
+    void *p;
+
+    spin_lock(&kmalloc_lock);
+    p = _malloc(nbytes);
+    spin_unlock(&kmalloc_lock);
+    return p;
 }
 
 void kfree(void* ptr)
 {
-    _free(ptr);
-}
\ No newline at end of file
+    spin_lock(&kmalloc_lock);
+    kheap_release(_free(ptr));
+    spin_unlock(&kmalloc_lock);
+}
@@ -1,8 +1,9 @@
 #ifndef JOS_INC_KMALLOC_H
 #define JOS_INC_KMALLOC_H
 
-extern char kheap[];
+extern uint32_t kheap_narenas;	// Arenas backing the kmalloc heap
+extern uint32_t kheap_npages;	// Pages in those arenas
 void* kmalloc(uint32_t nbytes);
 void kfree(void* ptr);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,235 @@
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/mmu.h>
+
+#include <kern/kmem.h>
+#include <kern/pmap.h>
+#include <kern/spinlock.h>
+
+// Slab allocator for fixed-size kernel objects.
+//
+// A cache keeps its slabs on three lists: partial slabs, which
+// allocations are served from; full slabs, which are left alone until
+// an object in them is freed; and at most one empty slab, kept so
+// that a cache hovering around a slab boundary doesn't keep going back
+// to page_alloc.  A slab that empties while there is already a spare
+// goes back to page_free.  Freeing an object finds its slab by rounding
+// the object's address down to the page.
+
+struct KmemSlab {
+	struct KmemCache *s_cache;	// The cache this slab belongs to
+	struct KmemSlab *s_next;	// Next slab on the same list
+	struct KmemSlab **s_pprev;	// Pointer to us on that list
+	void *s_free;			// First free object
+	int s_inuse;			// Objects allocated from this slab
+};
+
+struct KmemCache kmem_caches[KMEM_NCACHES];
+
+// Protects the kc_name of every slot in kmem_caches.
+static struct spinlock kmem_lock = SPINLOCK_INIT(kmem_lock);
+
+// Objects start this far into their slab.
+#define KMEM_SLABHDR	ROUNDUP(sizeof(struct KmemSlab), 8)
+
+static void
+slab_push(struct KmemSlab **list, struct KmemSlab *s)
+{
+	s->s_next = *list;
+	if (s->s_next)
+		s->s_next->s_pprev = &s->s_next;
+	s->s_pprev = list;
+	*list = s;
+}
+
+static void
+slab_unlink(struct KmemSlab *s)
+{
+	*s->s_pprev = s->s_next;
+	if (s->s_next)
+		s->s_next->s_pprev = s->s_pprev;
+	s->s_next = NULL;
+	s->s_pprev = NULL;
+}
+
+// Build a new slab for cp out of a fresh page.  Requires cp->kc_lock.
+static struct KmemSlab *
+slab_create(struct KmemCache *cp)
+{
+	struct PageInfo *pp;
+	struct KmemSlab *s;
+	char *obj;
+	int i;
+
+	if (!(pp = page_alloc(0)))
+		return NULL;
+
+	s = page2kva(pp);
+	s->s_cache = cp;
+	s->s_next = NULL;
+	s->s_pprev = NULL;
+	s->s_inuse = 0;
+	s->s_free = NULL;
+
+	// Thread the free list so that objects are handed out in
+	// address order.
+	obj = (char *) s + KMEM_SLABHDR + (cp->kc_perslab - 1) * cp->kc_size;
+	for (i = 0; i < cp->kc_perslab; i++, obj -= cp->kc_size) {
+		*(void **) obj = s->s_free;
+		s->s_free = obj;
+	}
+
+	cp->kc_nslabs++;
+	cp->kc_nslabs_created++;
+	return s;
+}
+
+// Give an empty, unlinked slab's page back.  Requires cp->kc_lock.
+static void
+slab_destroy(struct KmemCache *cp, struct KmemSlab *s)
+{
+	assert(s->s_inuse == 0);
+	s->s_cache = NULL;
+	page_free(pa2page(PADDR(s)));
+	cp->kc_nslabs--;
+	cp->kc_nslabs_destroyed++;
+}
+
+//
+// Create a cache of objects of 'size' bytes, named 'name' in the
+// statistics and in the lock list.  'name' must stay valid for as long
+// as the cache does.
+// Returns NULL if the objects don't fit in a page or every
+// cache slot is taken.
+//
+struct KmemCache *
+kmem_cache_create(const char *name, size_t size)
+{
+	struct KmemCache *cp;
+
+	size = ROUNDUP(MAX(size, sizeof(void *)), 8);
+	if (size > PGSIZE - KMEM_SLABHDR)
+		return NULL;
+
+	spin_lock(&kmem_lock);
+	for (cp = kmem_caches; cp < kmem_caches + KMEM_NCACHES; cp++)
+		if (!cp->kc_name)
+			break;
+	if (cp == kmem_caches + KMEM_NCACHES) {
+		spin_unlock(&kmem_lock);
+		return NULL;
+	}
+
+	cp->kc_name = name;
+	cp->kc_size = size;
+	cp->kc_perslab = (PGSIZE - KMEM_SLABHDR) / size;
+	cp->kc_partial = cp->kc_full = cp->kc_empty = NULL;
+	cp->kc_nalloc = cp->kc_nfree = cp->kc_nfail = 0;
+	cp->kc_inuse = cp->kc_maxinuse = cp->kc_nslabs = 0;
+	cp->kc_nslabs_created = cp->kc_nslabs_destroyed = 0;
+
+	// A slot's lock is initialised once and then stays on the list of
+	// all locks, which links through it; a reused slot only renames
+	// it and clears its statistics.
+	if (!cp->kc_lockinit) {
+		__spin_initlock(&cp->kc_lock, (char *) name);
+		cp->kc_lockinit = 1;
+	} else {
+		cp->kc_lock.name = (char *) name;
+		cp->kc_lock.nacquire = cp->kc_lock.ncontended = 0;
+		cp->kc_lock.spin_cycles = 0;
+	}
+	spin_unlock(&kmem_lock);
+	return cp;
+}
+
+//
+// Free cp's slot.  Every object must have been freed already.
+//
+void
+kmem_cache_destroy(struct KmemCache *cp)
+{
+	spin_lock(&cp->kc_lock);
+	if (cp->kc_inuse || cp->kc_partial || cp->kc_full)
+		panic("kmem_cache_destroy: %s still has objects in use",
+		      cp->kc_name);
+	if (cp->kc_empty) {
+		struct KmemSlab *s = cp->kc_empty;
+		slab_unlink(s);
+		slab_destroy(cp, s);
+	}
+	spin_unlock(&cp->kc_lock);
+
+	spin_lock(&kmem_lock);
+	cp->kc_name = NULL;
+	spin_unlock(&kmem_lock);
+}
+
+//
+// Allocate an object from cp.  Its contents are undefined.
+// Returns NULL if out of memory.
+//
+void *
+kmem_cache_alloc(struct KmemCache *cp)
+{
+	struct KmemSlab *s;
+	void *obj;
+
+	spin_lock(&cp->kc_lock);
+	if (!(s = cp->kc_partial)) {
+		if ((s = cp->kc_empty))
+			slab_unlink(s);
+		else if (!(s = slab_create(cp))) {
+			cp->kc_nfail++;
+			spin_unlock(&cp->kc_lock);
+			return NULL;
+		}
+		slab_push(&cp->kc_partial, s);
+	}
+
+	obj = s->s_free;
+	s->s_free = *(void **) obj;
+	if (++s->s_inuse == cp->kc_perslab) {
+		slab_unlink(s);
+		slab_push(&cp->kc_full, s);
+	}
+
+	cp->kc_nalloc++;
+	if (++cp->kc_inuse > cp->kc_maxinuse)
+		cp->kc_maxinuse = cp->kc_inuse;
+	spin_unlock(&cp->kc_lock);
+	return obj;
+}
+
+//
+// Return obj, which came from kmem_cache_alloc(cp), to cp.
+//
+void
+kmem_cache_free(struct KmemCache *cp, void *obj)
+{
+	struct KmemSlab *s = ROUNDDOWN(obj, PGSIZE);
+
+	if (s->s_cache != cp)
+		panic("kmem_cache_free: %08x is not from cache %s", obj,
+		      cp->kc_name);
+
+	spin_lock(&cp->kc_lock);
+	if (s->s_inuse-- == cp->kc_perslab) {
+		slab_unlink(s);
+		slab_push(&cp->kc_partial, s);
+	}
+	*(void **) obj = s->s_free;
+	s->s_free = obj;
+
+	if (s->s_inuse == 0) {
+		slab_unlink(s);
+		if (!cp->kc_empty)
+			slab_push(&cp->kc_empty, s);
+		else
+			slab_destroy(cp, s);
+	}
+
+	cp->kc_nfree++;
+	cp->kc_inuse--;
+	spin_unlock(&cp->kc_lock);
+}
@@ -0,0 +1,47 @@
+#ifndef JOS_KERN_KMEM_H
+#define JOS_KERN_KMEM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <kern/spinlock.h>
+
+// Most object caches that can exist at once.
+#define KMEM_NCACHES	16
+
+struct KmemSlab;
+
+// A cache of fixed-size kernel objects.  Objects are carved out of
+// single pages ("slabs") taken from page_alloc; each slab begins with
+// a struct KmemSlab and keeps its free objects on a list threaded
+// through the objects themselves.
+struct KmemCache {
+	const char *kc_name;		// NULL if this slot is unused
+	size_t kc_size;			// Object size, rounded up to 8 bytes
+	int kc_perslab;			// Objects that fit in one slab
+	struct KmemSlab *kc_partial;	// Slabs with some objects free
+	struct KmemSlab *kc_full;	// Slabs with no objects free
+	struct KmemSlab *kc_empty;	// A spare slab with every object free
+	struct spinlock kc_lock;	// Protects the slabs and statistics
+	bool kc_lockinit;		// Has kc_lock been initialised?
+
+	// Statistics; see the monitor's "kmem" command.
+	uint32_t kc_nalloc;		// Objects handed out
+	uint32_t kc_nfree;		// Objects given back
+	uint32_t kc_nfail;		// Allocations that found no memory
+	uint32_t kc_inuse;		// Objects allocated now
+	uint32_t kc_maxinuse;		// Most objects ever allocated at once
+	uint32_t kc_nslabs;		// Slabs (pages) held now
+	uint32_t kc_nslabs_created;
+	uint32_t kc_nslabs_destroyed;
+};
+
+extern struct KmemCache kmem_caches[KMEM_NCACHES];
+
+struct KmemCache *kmem_cache_create(const char *name, size_t size);
+void	kmem_cache_destroy(struct KmemCache *cp);
+void	*kmem_cache_alloc(struct KmemCache *cp);
+void	kmem_cache_free(struct KmemCache *cp, void *obj);
+
+#endif /* !JOS_KERN_KMEM_H */
@@ -32,6 +32,7 @@
 #define ICRHI   (0x0310/4)   // Interrupt Command [63:32]
 #define TIMER   (0x0320/4)   // Local Vector Table 0 (TIMER)
 	#define X1         0x0000000B   // divide counts by 1
+	#define ONESHOT    0x00000000   // One-shot
 	#define PERIODIC   0x00020000   // Periodic
 #define PCINT   (0x0340/4)   // Performance Counter LVT
 #define LINT0   (0x0350/4)   // Local Vector Table 1 (LINT0)
@@ -42,6 +43,9 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+// Timer counts in one scheduler tick, nominally 10ms.
+#define TICK    10000000
+
 physaddr_t lapicaddr;        // Initialized in mpconfig.c
 volatile uint32_t *lapic;
 
@@ -68,13 +72,13 @@ lapic_init(void)
 	// Enable local APIC; set spurious interrupt vector.
 	lapicw(SVR, ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
 
-	// The timer repeatedly counts down at bus frequency
-	// from lapic[TICR] and then issues an interrupt.  
-	// If we cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
+	// The timer counts down at bus frequency from lapic[TICR]
+	// and then issues an interrupt.  It runs one-shot: the
+	// scheduler re-arms it only when this CPU has an env to
+	// preempt or a reason to wake up (see sched_set_timer).
 	lapicw(TDCR, X1);
-	lapicw(TIMER, PERIODIC | (IRQ_OFFSET + IRQ_TIMER));
-	lapicw(TICR, 10000000); 
+	lapicw(TIMER, ONESHOT | (IRQ_OFFSET + IRQ_TIMER));
+	lapicw(TICR, TICK);
 
 	// Leave LINT0 of the BSP enabled so that it can get
 	// interrupts from the 8259A chip.
@@ -130,6 +134,48 @@ lapic_eoi(void)
 		lapicw(EOI, 0);
 }
 
+// Arrange for a timer interrupt on this CPU within nticks ticks.
+// An earlier timer interrupt that is already pending is kept.
+// nticks == 0 cancels any pending timer interrupt.
+void
+lapic_timer_deadline(uint32_t nticks)
+{
+	uint32_t count;
+
+	if (!lapic)
+		return;
+
+	if (nticks == 0) {
+		lapicw(TICR, 0);
+		return;
+	}
+
+	count = MIN(nticks, 0xffffffff / TICK) * TICK;
+	if (lapic[TCCR] == 0 || lapic[TCCR] > count)
+		lapicw(TICR, count);
+}
+
+// Return the number of TSC cycles in one timer tick, measured by
+// timing a short countdown with the timer interrupt masked.
+// Leaves the timer disarmed.
+uint64_t
+lapic_timer_calibrate(void)
+{
+	uint64_t start;
+
+	if (!lapic)
+		return 0;
+
+	lapicw(TIMER, MASKED | ONESHOT | (IRQ_OFFSET + IRQ_TIMER));
+	start = read_tsc();
+	lapicw(TICR, TICK / 10);
+	while (lapic[TCCR] != 0)
+		;
+	start = read_tsc() - start;
+	lapicw(TIMER, ONESHOT | (IRQ_OFFSET + IRQ_TIMER));
+	return start * 10;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 static void
@@ -183,3 +229,13 @@ lapic_ipi(int vector)
 	while (lapic[ICRLO] & DELIVS)
 		;
 }
+
+// Send interrupt 'vector' to CPU 'cpu' only.
+void
+lapic_ipi_cpu(int cpu, int vector)
+{
+	lapicw(ICRHI, cpus[cpu].cpu_id << 24);
+	lapicw(ICRLO, FIXED | vector);
+	while (lapic[ICRLO] & DELIVS)
+		;
+}
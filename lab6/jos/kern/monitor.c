@@ -13,6 +13,9 @@
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
 #include <kern/trap.h>
+#include <kern/spinlock.h>
+#include <kern/kmem.h>
+#include <kern/kmalloc.h>
 
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
@@ -33,6 +36,9 @@ static struct Command commands[] = {
 	{ "c", "Continue", mon_continue },
 	{ "pmap", "Display paging mapping information", mon_paginginfo },
 	{ "envls", "List all user environments", mon_envls },
+	{ "locks", "Display spinlock contention ('locks reset' clears it)", mon_locks },
+	{ "kmem", "Display kernel object cache statistics", mon_kmem },
+	{ "zeropool", "Display pre-zeroed page pool use ('zeropool reset' clears it)", mon_zeropool },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -350,6 +356,93 @@ mon_envls(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+// Locks with the same name, such as the env locks, are summed into
+// one line.  The counts are approximate: other CPUs keep updating them
+// while we read.
+int
+mon_locks(int argc, char **argv, struct Trapframe *tf)
+{
+	struct spinlock *lk, *prev, *other;
+	uint32_t n, nacquire, ncontended;
+	uint64_t spin_cycles;
+
+	if(argc > 1 && strcmp(argv[1], "reset") == 0)
+	{
+		for(lk = spinlocks; lk; lk = lk->link)
+		{
+			lk->nacquire = lk->ncontended = 0;
+			lk->spin_cycles = 0;
+		}
+		return 0;
+	}
+
+	cprintf("%-16s %5s %10s %10s %14s %8s\n", "lock", "count",
+		"acquires", "contended", "spin cycles", "avg spin");
+	for(lk = spinlocks; lk; lk = lk->link)
+	{
+		// only report each name the first time we see it
+		for(prev = spinlocks; prev != lk; prev = prev->link)
+			if(strcmp(prev->name, lk->name) == 0)
+				break;
+		if(prev != lk)
+			continue;
+
+		n = nacquire = ncontended = 0;
+		spin_cycles = 0;
+		for(other = lk; other; other = other->link)
+		{
+			if(strcmp(other->name, lk->name) != 0)
+				continue;
+			n++;
+			nacquire += other->nacquire;
+			ncontended += other->ncontended;
+			spin_cycles += other->spin_cycles;
+		}
+		cprintf("%-16s %5u %10u %10u %14llu %8llu\n", lk->name, n,
+			nacquire, ncontended, spin_cycles,
+			ncontended ? spin_cycles / ncontended : 0);
+	}
+
+	return 0;
+}
+
+int
+mon_zeropool(int argc, char **argv, struct Trapframe *tf)
+{
+	struct PageZeroStats st;
+	bool reset = argc > 1 && strcmp(argv[1], "reset") == 0;
+
+	page_zero_stats(&st, reset);
+	if (reset)
+		return 0;
+
+	cprintf("zero pool: %d/%d pages, %u filled by idle CPUs\n",
+		st.pz_npages, st.pz_target, st.pz_filled);
+	cprintf("ALLOC_ZERO: %u served from pool, %u found it dry\n",
+		st.pz_hits, st.pz_misses);
+	return 0;
+}
+
+int
+mon_kmem(int argc, char **argv, struct Trapframe *tf)
+{
+	struct KmemCache *cp;
+
+	cprintf("%-16s %6s %6s %8s %8s %10s %10s %6s\n", "cache", "size",
+		"slabs", "in use", "max use", "allocs", "frees", "fails");
+	for (cp = kmem_caches; cp < kmem_caches + KMEM_NCACHES; cp++) {
+		if (!cp->kc_name)
+			continue;
+		cprintf("%-16s %6u %6u %8u %8u %10u %10u %6u\n", cp->kc_name,
+			cp->kc_size, cp->kc_nslabs, cp->kc_inuse,
+			cp->kc_maxinuse, cp->kc_nalloc, cp->kc_nfree,
+			cp->kc_nfail);
+	}
+	cprintf("kmalloc heap: %u pages in %u arenas\n", kheap_npages,
+		kheap_narenas);
+	return 0;
+}
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
@@ -84,3 +84,12 @@ irq_setmask_8259A(uint16_t mask)
 	cprintf("\n");
 }
 
+
+// Acknowledge interrupt 'irq'.  The master is in automatic EOI mode,
+// but the slave is not.
+void
+irq_eoi_8259A(int irq)
+{
+	if (irq >= 8)
+		outb(IO_PIC2, 0x20);
+}
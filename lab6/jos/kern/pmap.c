@@ -11,6 +11,8 @@
 #include <kern/cpu.h>
 #include <kern/env.h>
 #include <kern/kmalloc.h>
+#include <kern/kmem.h>
+#include <kern/spinlock.h>
 
 #define boot_alloc(n) _boot_alloc(n, PGSIZE)
 #define debug 0
@@ -25,7 +27,53 @@ static size_t npages_basemem;	// Amount of base memory (in pages)
 // These variables are set in mem_init()
 pde_t *kern_pgdir;		// Kernel's initial page directory
 struct PageInfo *pages;		// Physical page state array
-static struct PageInfo *page_free_list;	// Free list of physical pages
+
+// Buddy free lists of physical pages.  page_free_area[k] holds the free
+// blocks of 2^k contiguous pages whose first page number is a multiple
+// of 2^k, linked through their first pages.
+static struct PageInfo *page_free_area[PAGE_MAX_ORDER + 1];
+
+// Protects page_free_area and the pp_ref counts of all pages.
+static struct spinlock page_lock = SPINLOCK_INIT(page_lock);
+
+// Per-CPU caches of free single pages in front of page_free_area.
+// page_alloc and page_free only use the current CPU's cache.  The
+// caches are not lock-free: each has a pc_lock, which the fast path
+// takes too.  Running with interrupts off keeps this CPU's own code off
+// the cache, but not other CPUs, and when memory runs out
+// page_cache_drain_all empties every CPU's cache from whichever CPU
+// ran short.  Since other CPUs take pc_lock only then, the fast path
+// costs one uncontended locked instruction on a cache line that stays
+// in this CPU's cache, rather than a trip to the shared page_lock.
+// pc_lock comes before page_lock.  A cache refills from and drains to
+// the buddy lists PAGE_CACHE_BATCH pages at a time, under a single
+// acquisition of page_lock.
+#define PAGE_CACHE_SIZE		32
+#define PAGE_CACHE_BATCH	16
+
+struct PageCache {
+	struct spinlock pc_lock;
+	int pc_count;
+	struct PageInfo *pc_pages[PAGE_CACHE_SIZE];
+
+	// This CPU's share of the zero pool counters.
+	uint32_t pc_zero_hits;
+	uint32_t pc_zero_misses;
+	uint32_t pc_zero_filled;
+} __attribute__ ((aligned(64)));
+
+static struct PageCache page_caches[NCPU];
+
+// Pool of pages that idle CPUs have already zeroed, linked through
+// pp_link, so that page_alloc(ALLOC_ZERO) need not clear a page on the
+// caller's time.  sched_halt tops it up to PAGE_ZERO_POOL pages, and
+// page_alloc_order empties it into the buddy lists when a larger block
+// can't be found without it.
+#define PAGE_ZERO_POOL		128
+
+static struct PageInfo *page_zero_pool;
+static int page_zero_npages;
+static struct spinlock page_zero_lock = SPINLOCK_INIT(page_zero_lock);
 int pse_supported;
 
 
@@ -80,6 +128,8 @@ static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va);
 static void check_page(void);
 static void check_page_installed_pgdir(void);
 static void check_kmalloc(void);
+static void check_kmem_cache(void);
+static void __page_free_order(struct PageInfo *pp, int order);
 
 // This simple physical memory allocator is used only while JOS is setting
 // up its virtual memory system.  page_alloc() is the real allocator.
@@ -92,7 +142,7 @@ static void check_kmalloc(void);
 //
 // If we're out of memory, boot_alloc should panic.
 // This function may ONLY be used during initialization,
-// before the page_free_list list has been set up.
+// before the page_free_area lists have been set up.
 static void *
 _boot_alloc(uint32_t n, uint32_t alignment)
 {
@@ -291,6 +341,7 @@ mem_init(void)
 	cprintf("total = %dK\n", (cnt + n)/1024);
 	
 	check_kmalloc();
+	check_kmem_cache();
 }
 
 void
@@ -347,10 +398,10 @@ mem_init_mp(void)
 // --------------------------------------------------------------
 
 //
-// Initialize page structure and memory free list.
+// Initialize page structure and memory free lists.
 // After this is done, NEVER use boot_alloc again.  ONLY use the page
 // allocator functions below to allocate and deallocate physical
-// memory via the page_free_list.
+// memory via the page_free_area lists.
 //
 void
 page_init(void)
@@ -373,7 +424,9 @@ page_init(void)
 	// NB: DO NOT actually touch the physical memory corresponding to
 	// free pages!
 	size_t i;
-	struct PageInfo *pinfo = NULL;
+
+	for (i = 0; i < NCPU; i++)
+		__spin_initlock(&page_caches[i].pc_lock, "page_cache_lock");
 
 	pages[0].pp_ref = 1;
 
@@ -381,25 +434,9 @@ page_init(void)
 	{
 		//skip pages for mp entry code
 		if (i == MPENTRY_PADDR / PGSIZE)
-		{
 			pages[i].pp_ref = 1;
-			continue;
-		}
-
-		pages[i].pp_ref = 0;
-
-		if(!pinfo)
-		{
-			//root
-			pinfo = &pages[i];
-			page_free_list = pinfo;
-		}
-
 		else
-		{
-			pinfo->pp_link = &pages[i];
-			pinfo = pinfo->pp_link;
-		}
+			pages[i].pp_ref = 0;
 	}
 
 	if (npages_basemem != IOPHYSMEM / PGSIZE)
@@ -413,26 +450,258 @@ page_init(void)
 	for (i = EXTPHYSMEM / PGSIZE; i < npages; ++i) 
 	{
 		if (i < PADDR(boot_alloc(0)) / PGSIZE)
-		{
 			pages[i].pp_ref = 1;
-		}
 		else
-		{
 			pages[i].pp_ref = 0;
+	}
 
-			if(!pinfo)
-			{
-				//root
-				pinfo = &pages[i];
-				page_free_list = pinfo;
-			}
-			else
-			{
-				pinfo->pp_link = &pages[i];
-				pinfo = pinfo->pp_link;
-			}
-		}
+	// Free from the top down so that, once the buddies have merged,
+	// the lowest block of each order sits at the head of its list.
+	// entry_pgdir only maps the bottom 4MB, and the checks below
+	// touch the first pages they are handed.
+	for (i = npages; i-- > 0; )
+		if (pages[i].pp_ref == 0)
+			__page_free_order(&pages[i], 0);
+}
+
+static inline void
+page_push(struct PageInfo *pp, int order)
+{
+	pp->pp_free = 1;
+	pp->pp_order = order;
+	pp->pp_link = page_free_area[order];
+	if (pp->pp_link)
+		pp->pp_link->pp_pprev = &pp->pp_link;
+	pp->pp_pprev = &page_free_area[order];
+	page_free_area[order] = pp;
+}
+
+static inline void
+page_unlink(struct PageInfo *pp)
+{
+	*pp->pp_pprev = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_pprev = pp->pp_pprev;
+	pp->pp_link = NULL;
+	pp->pp_pprev = NULL;
+	pp->pp_free = 0;
+}
+
+//
+// Take a block of 2^order pages off the buddy lists, splitting a larger
+// block if need be.  Requires page_lock.
+//
+static struct PageInfo *
+__page_alloc_order(int order)
+{
+	struct PageInfo *result;
+	int k;
+
+	for (k = order; k <= PAGE_MAX_ORDER && !page_free_area[k]; k++)
+		;
+	if (k > PAGE_MAX_ORDER)
+		return NULL;
+
+	result = page_free_area[k];
+	if (result->pp_ref != 0)
+		panic("page_alloc: kva [%08x] pp_ref = %d", page2kva(result), result->pp_ref);
+	page_unlink(result);
+
+	// Split the block, returning the upper halves to the free lists.
+	while (k > order) {
+		k--;
+		page_push(result + (1 << k), k);
+	}
+	return result;
+}
+
+//
+// Return a block of 2^order pages to the free lists, merging it with
+// its buddy for as long as the buddy is free and whole.
+// Requires page_lock, except during page_init.
+//
+static void
+__page_free_order(struct PageInfo *pp, int order)
+{
+	size_t pn = pp - pages, bn;
+
+	while (order < PAGE_MAX_ORDER) {
+		bn = pn ^ (1 << order);
+		if (bn >= npages || !pages[bn].pp_free
+		    || pages[bn].pp_order != order)
+			break;
+		page_unlink(&pages[bn]);
+		pn &= ~(size_t) (1 << order);
+		order++;
+	}
+	page_push(&pages[pn], order);
+}
+
+//
+// Move up to PAGE_CACHE_BATCH pages from the buddy lists into pc.
+//
+static void
+page_cache_refill(struct PageCache *pc)
+{
+	struct PageInfo *pp;
+
+	spin_lock(&page_lock);
+	while (pc->pc_count < PAGE_CACHE_BATCH
+	       && (pp = __page_alloc_order(0)))
+		pc->pc_pages[pc->pc_count++] = pp;
+	spin_unlock(&page_lock);
+}
+
+//
+// Return the n least recently freed pages in pc to the buddy lists.
+//
+static void
+page_cache_drain(struct PageCache *pc, int n)
+{
+	int i;
+
+	if (n > pc->pc_count)
+		n = pc->pc_count;
+	spin_lock(&page_lock);
+	for (i = 0; i < n; i++)
+		__page_free_order(pc->pc_pages[i], 0);
+	spin_unlock(&page_lock);
+	pc->pc_count -= n;
+	memmove(pc->pc_pages, pc->pc_pages + n,
+		pc->pc_count * sizeof(pc->pc_pages[0]));
+}
+
+//
+// Return every CPU's cached pages to the buddy lists, so that an
+// allocation near OOM doesn't fail while other CPUs sit on free pages.
+// The caller must not hold any pc_lock.  Returns the number of pages
+// moved.
+//
+static int
+page_cache_drain_all(void)
+{
+	struct PageCache *pc;
+	int n = 0;
+
+	for (pc = page_caches; pc < page_caches + NCPU; pc++) {
+		spin_lock(&pc->pc_lock);
+		n += pc->pc_count;
+		page_cache_drain(pc, pc->pc_count);
+		spin_unlock(&pc->pc_lock);
+	}
+	return n;
+}
+
+//
+// Pop a page from pc, refilling it if it is empty.
+//
+static struct PageInfo *
+page_cache_get(struct PageCache *pc)
+{
+	struct PageInfo *pp;
+
+	if (pc->pc_count == 0)
+		page_cache_refill(pc);
+	if (pc->pc_count == 0)
+		return NULL;
+
+	pp = pc->pc_pages[--pc->pc_count];
+	if (pp->pp_ref != 0)
+		panic("page_alloc: kva [%08x] pp_ref = %d", page2kva(pp), pp->pp_ref);
+	return pp;
+}
+
+//
+// Take a page from the zero pool, or return NULL if it is empty.
+//
+static struct PageInfo *
+page_zero_take(void)
+{
+	struct PageInfo *pp;
+
+	// Don't bother with the lock when the pool is plainly empty.
+	if (!page_zero_pool)
+		return NULL;
+
+	spin_lock(&page_zero_lock);
+	if ((pp = page_zero_pool)) {
+		page_zero_pool = pp->pp_link;
+		pp->pp_link = NULL;
+		page_zero_npages--;
+	}
+	spin_unlock(&page_zero_lock);
+	return pp;
+}
+
+//
+// Return every page in the zero pool to the buddy lists.
+// Returns the number of pages returned.
+//
+static int
+page_zero_drain(void)
+{
+	struct PageInfo *pool, *pp;
+	int n = 0;
+
+	spin_lock(&page_zero_lock);
+	pool = page_zero_pool;
+	page_zero_pool = NULL;
+	page_zero_npages = 0;
+	spin_unlock(&page_zero_lock);
+
+	spin_lock(&page_lock);
+	while ((pp = pool)) {
+		pool = pp->pp_link;
+		pp->pp_link = NULL;
+		__page_free_order(pp, 0);
+		n++;
 	}
+	spin_unlock(&page_lock);
+	return n;
+}
+
+//
+// Allocates 2^order physically contiguous pages, aligned to their size.
+// If (alloc_flags & ALLOC_ZERO), fills all of them with '\0' bytes.
+// Like page_alloc, does NOT increment any reference count; the pages
+// are handed back one at a time with page_free, or all at once with
+// page_free_order.
+//
+// Returns NULL if there is no free block of that size.
+//
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct PageInfo *result;
+
+	if (order < 0 || order > PAGE_MAX_ORDER)
+		return NULL;
+
+	spin_lock(&page_lock);
+	result = __page_alloc_order(order);
+	spin_unlock(&page_lock);
+
+	// Single pages parked in the per-CPU caches may be the buddies
+	// that a larger block is missing.
+	if (!result && page_cache_drain_all() > 0) {
+		spin_lock(&page_lock);
+		result = __page_alloc_order(order);
+		spin_unlock(&page_lock);
+	}
+
+	// So may the pages in the zero pool.
+	if (!result && page_zero_drain() > 0) {
+		spin_lock(&page_lock);
+		result = __page_alloc_order(order);
+		spin_unlock(&page_lock);
+	}
+	if (!result)
+		return NULL;
+
+	if (alloc_flags & ALLOC_ZERO)
+		memset(page2kva(result), 0, PGSIZE << order);
+
+	return result;
 }
 
 //
@@ -450,18 +719,31 @@ page_init(void)
 struct PageInfo *
 page_alloc(int alloc_flags)
 {
+	struct PageCache *pc = &page_caches[cpunum()];
 	struct PageInfo *result;
 
-	// Fill this function in
-	if (!page_free_list)
-		return NULL;
-	
-	if (page_free_list->pp_ref != 0)
-		panic("page_alloc: kva [%08x] pp_ref = %d", page2kva(page_free_list), page_free_list->pp_ref);
-	
-	result = page_free_list;
-	page_free_list = page_free_list->pp_link;
-	result->pp_link = NULL;
+	if (alloc_flags & ALLOC_ZERO) {
+		if ((result = page_zero_take())) {
+			pc->pc_zero_hits++;
+			return result;
+		}
+		pc->pc_zero_misses++;
+	}
+
+	spin_lock(&pc->pc_lock);
+	result = page_cache_get(pc);
+	spin_unlock(&pc->pc_lock);
+
+	// Before giving up, take back what the other CPUs have cached.
+	if (!result && page_cache_drain_all() > 0) {
+		spin_lock(&pc->pc_lock);
+		result = page_cache_get(pc);
+		spin_unlock(&pc->pc_lock);
+	}
+
+	// Out of dirty pages, a zeroed one will do.
+	if (!result)
+		return page_zero_take();
 
 	if (alloc_flags & ALLOC_ZERO)
 		memset(page2kva(result), 0, PGSIZE);
@@ -469,6 +751,73 @@ page_alloc(int alloc_flags)
 	return result;
 }
 
+//
+// Zero one free page and add it to the zero pool.  Called by idle
+// CPUs; returns 0 once the pool is full or memory has run out.
+//
+int
+page_zero_fill(void)
+{
+	struct PageCache *pc = &page_caches[cpunum()];
+	struct PageInfo *pp;
+
+	if (page_zero_npages >= PAGE_ZERO_POOL)
+		return 0;
+	spin_lock(&pc->pc_lock);
+	pp = page_cache_get(pc);
+	spin_unlock(&pc->pc_lock);
+	if (!pp)
+		return 0;
+	memset(page2kva(pp), 0, PGSIZE);
+
+	spin_lock(&page_zero_lock);
+	pp->pp_link = page_zero_pool;
+	page_zero_pool = pp;
+	page_zero_npages++;
+	spin_unlock(&page_zero_lock);
+
+	pc->pc_zero_filled++;
+	return 1;
+}
+
+//
+// Sum up the zero pool counters, and clear them if reset is set.
+//
+void
+page_zero_stats(struct PageZeroStats *st, bool reset)
+{
+	struct PageCache *pc;
+
+	memset(st, 0, sizeof(*st));
+	st->pz_npages = page_zero_npages;
+	st->pz_target = PAGE_ZERO_POOL;
+	for (pc = page_caches; pc < page_caches + NCPU; pc++) {
+		st->pz_hits += pc->pc_zero_hits;
+		st->pz_misses += pc->pc_zero_misses;
+		st->pz_filled += pc->pc_zero_filled;
+		if (reset)
+			pc->pc_zero_hits = pc->pc_zero_misses =
+				pc->pc_zero_filled = 0;
+	}
+}
+
+void
+page_free_order(struct PageInfo *pp, int order)
+{
+	if (order < 0 || order > PAGE_MAX_ORDER)
+		panic("page_free_order: bad order %d", order);
+	if ((pp - pages) & ((1 << order) - 1))
+		panic("page_free_order: block is not aligned");
+	if (pp->pp_ref != 0)
+	 	panic("page_free: pp_ref != 0");
+	if (pp->pp_link != NULL || pp->pp_free)
+		panic("page_free: pp_link != NULL");
+
+	spin_lock(&page_lock);
+	__page_free_order(pp, order);
+	spin_unlock(&page_lock);
+}
+
 //
 // Return a page to the free list.
 // (This function should only be called when pp->pp_ref reaches 0.)
@@ -476,17 +825,18 @@ page_alloc(int alloc_flags)
 void
 page_free(struct PageInfo *pp)
 {
-	// Fill this function in
-	// Hint: You may want to panic if pp->pp_ref is nonzero or
-	// pp->pp_link is not NULL.
-	
+	struct PageCache *pc = &page_caches[cpunum()];
+
 	if (pp->pp_ref != 0)
 	 	panic("page_free: pp_ref != 0");
-	if (pp->pp_link != NULL)
+	if (pp->pp_link != NULL || pp->pp_free)
 		panic("page_free: pp_link != NULL");
 
-	pp->pp_link = page_free_list;
-	page_free_list = pp;
+	spin_lock(&pc->pc_lock);
+	if (pc->pc_count == PAGE_CACHE_SIZE)
+		page_cache_drain(pc, PAGE_CACHE_BATCH);
+	pc->pc_pages[pc->pc_count++] = pp;
+	spin_unlock(&pc->pc_lock);
 }
 
 //
@@ -496,7 +846,14 @@ page_free(struct PageInfo *pp)
 void
 page_decref(struct PageInfo* pp)
 {
-	if (--pp->pp_ref == 0)
+	bool last;
+
+	// Other address spaces may map pp too.
+	spin_lock(&page_lock);
+	last = (--pp->pp_ref == 0);
+	spin_unlock(&page_lock);
+
+	if (last)
 		page_free(pp);
 }
 
@@ -648,7 +1005,9 @@ page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 
 	// corner case: if pp is already mapped to va, incrementing before remove will
 	// not cause page_remove to free pp
+	spin_lock(&page_lock);
 	++ pp->pp_ref; 
+	spin_unlock(&page_lock);
 	if (*tab_entry & PTE_P) {
 		if(debug)
 			cprintf("page_insert: remap [%08x] from [%08x] to [%08x]\n",
@@ -858,6 +1217,8 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm)
 // If it can, then the function simply returns.
 // If it cannot, 'env' is destroyed and, if env is the current
 // environment, this function will not return.
+// The caller holds env's lock, and keeps holding it for as long as it
+// uses the memory, so that the pages can't be unmapped under it.
 //
 void
 user_mem_assert(struct Env *env, const void *va, size_t len, int perm)
@@ -904,60 +1265,111 @@ void* mmio_map_region(physaddr_t lapicaddr, size_t size)
 // --------------------------------------------------------------
 
 //
-// Check that the pages on the page_free_list are reasonable.
+// Count the free pages, on the page_free_area lists, in the per-CPU
+// caches and in the zero pool.
+//
+static int
+check_page_nfree(void)
+{
+	struct PageInfo *pp;
+	int i, k, nfree = 0;
+
+	for (k = 0; k <= PAGE_MAX_ORDER; k++)
+		for (pp = page_free_area[k]; pp; pp = pp->pp_link)
+			nfree += 1 << k;
+	for (i = 0; i < NCPU; i++)
+		nfree += page_caches[i].pc_count;
+	return nfree + page_zero_npages;
+}
+
+//
+// Allocate every remaining free page, chained through pp_link.
+//
+static struct PageInfo *
+check_page_steal(void)
+{
+	struct PageInfo *pp, *fl = NULL;
+
+	while ((pp = page_alloc(0))) {
+		pp->pp_link = fl;
+		fl = pp;
+	}
+	return fl;
+}
+
+//
+// Give back pages taken by check_page_steal.
 //
 static void
-check_page_free_list(bool only_low_memory)
+check_page_unsteal(struct PageInfo *fl)
 {
 	struct PageInfo *pp;
+
+	while ((pp = fl)) {
+		fl = pp->pp_link;
+		pp->pp_link = NULL;
+		page_free(pp);
+	}
+}
+
+//
+// Check that the pages on the page_free_area lists are reasonable.
+//
+static void
+check_page_free_list(bool only_low_memory)
+{
+	struct PageInfo *pp, *blk;
 	unsigned pdx_limit = only_low_memory ? 1 : NPDENTRIES;
 	int nfree_basemem = 0, nfree_extmem = 0;
 	char *first_free_page;
+	int k, nblk = 0;
 
-	if (!page_free_list)
-		panic("'page_free_list' is a null pointer!");
-
-	if (only_low_memory) {
-		// Move pages with lower addresses first in the free
-		// list, since entry_pgdir does not map all pages.
-		struct PageInfo *pp1, *pp2;
-		struct PageInfo **tp[2] = { &pp1, &pp2 };
-		for (pp = page_free_list; pp; pp = pp->pp_link) {
-			int pagetype = PDX(page2pa(pp)) >= pdx_limit;
-			*tp[pagetype] = pp;
-			tp[pagetype] = &pp->pp_link;
-		}
-		*tp[1] = 0;
-		*tp[0] = pp2;
-		page_free_list = pp1;
-	}
+	for (k = 0; k <= PAGE_MAX_ORDER; k++)
+		if (page_free_area[k])
+			nblk++;
+	if (!nblk)
+		panic("'page_free_area' is empty!");
+
+	// page_init leaves the lowest block of each order at the head of
+	// its list, so there is no need to move the pages that
+	// entry_pgdir maps to the front.
 
 	// if there's a page that shouldn't be on the free list,
 	// try to make sure it eventually causes trouble.
-	for (pp = page_free_list; pp; pp = pp->pp_link)
-		if (PDX(page2pa(pp)) < pdx_limit)
-			memset(page2kva(pp), 0x97, 128);
+	for (k = 0; k <= PAGE_MAX_ORDER; k++)
+		for (blk = page_free_area[k]; blk; blk = blk->pp_link)
+			for (pp = blk; pp < blk + (1 << k); pp++)
+				if (PDX(page2pa(pp)) < pdx_limit)
+					memset(page2kva(pp), 0x97, 128);
 
 	first_free_page = (char *) boot_alloc(0);
-	for (pp = page_free_list; pp; pp = pp->pp_link) {
-		assert(pp->pp_ref == 0);
-		// check that we didn't corrupt the free list itself
-		assert(pp >= pages);
-		assert(pp < pages + npages);
-		assert(((char *) pp - (char *) pages) % sizeof(*pp) == 0);
-
-		// check a few pages that shouldn't be on the free list
-		assert(page2pa(pp) != 0);
-		assert(page2pa(pp) != IOPHYSMEM);
-		assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
-		assert(page2pa(pp) != EXTPHYSMEM);
-		assert(page2pa(pp) < EXTPHYSMEM || (char *) page2kva(pp) >= first_free_page);
-		assert(page2pa(pp) != MPENTRY_PADDR);
-
-		if (page2pa(pp) < EXTPHYSMEM)
-			++nfree_basemem;
-		else
-			++nfree_extmem;
+	for (k = 0; k <= PAGE_MAX_ORDER; k++) {
+		for (blk = page_free_area[k]; blk; blk = blk->pp_link) {
+			// check that we didn't corrupt the free lists themselves
+			assert(blk >= pages);
+			assert(blk + (1 << k) <= pages + npages);
+			assert(((char *) blk - (char *) pages) % sizeof(*blk) == 0);
+			assert(blk->pp_free && blk->pp_order == k);
+			assert(((blk - pages) & ((1 << k) - 1)) == 0);
+			assert(blk->pp_link == NULL || blk->pp_link->pp_pprev == &blk->pp_link);
+
+			for (pp = blk; pp < blk + (1 << k); pp++) {
+				assert(pp->pp_ref == 0);
+
+				// check a few pages that shouldn't be on the free list
+				assert(page2pa(pp) != 0);
+				assert(page2pa(pp) != IOPHYSMEM);
+				assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
+				assert(page2pa(pp) != EXTPHYSMEM);
+				assert(page2pa(pp) < EXTPHYSMEM || (char *) page2kva(pp) >= first_free_page);
+				assert(page2pa(pp) != MPENTRY_PADDR);
+
+				if (page2pa(pp) < EXTPHYSMEM)
+					++nfree_basemem;
+				else
+					++nfree_extmem;
+			}
+		}
 	}
 
 	assert(nfree_basemem > 0);
@@ -973,7 +1385,7 @@ check_page_free_list(bool only_low_memory)
 static void
 check_page_alloc(void)
 {
-	struct PageInfo *pp, *pp0, *pp1, *pp2;
+	struct PageInfo *pp, *pp0, *pp1, *pp2, *blk;
 	int nfree;
 	struct PageInfo *fl;
 	char *c;
@@ -983,8 +1395,11 @@ check_page_alloc(void)
 		panic("'pages' is a null pointer!");
 
 	// check number of free pages
-	for (pp = page_free_list, nfree = 0; pp; pp = pp->pp_link)
-		++nfree;
+	nfree = check_page_nfree();
+
+	// should be able to allocate an aligned block of four pages
+	assert((blk = page_alloc_order(2, 0)));
+	assert(((blk - pages) & 3) == 0);
 
 	// should be able to allocate three pages
 	pp0 = pp1 = pp2 = 0;
@@ -998,10 +1413,10 @@ check_page_alloc(void)
 	assert(page2pa(pp0) < npages*PGSIZE);
 	assert(page2pa(pp1) < npages*PGSIZE);
 	assert(page2pa(pp2) < npages*PGSIZE);
+	assert(pp0 < blk || pp0 >= blk + 4);
 
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	page_free_list = 0;
+	fl = check_page_steal();
 
 	// should be no free memory
 	assert(!page_alloc(0));
@@ -1028,8 +1443,23 @@ check_page_alloc(void)
 	for (i = 0; i < PGSIZE; i++)
 		assert(c[i] == 0);
 
+	// freeing the block a page at a time parks it in this CPU's page
+	// cache; a larger allocation should drain the cache and coalesce
+	// it again, but no further: its buddies are all allocated
+	memset(page2kva(blk), 1, 4 * PGSIZE);
+	for (i = 3; i >= 0; i--)
+		page_free(blk + i);
+	assert(!page_alloc_order(3, 0));
+	assert((pp = page_alloc_order(2, ALLOC_ZERO)));
+	assert(pp == blk);
+	c = page2kva(pp);
+	for (i = 0; i < 4 * PGSIZE; i++)
+		assert(c[i] == 0);
+	assert(!page_alloc(0));
+	page_free_order(blk, 2);
+
 	// give free list back
-	page_free_list = fl;
+	check_page_unsteal(fl);
 
 	// free the pages we took
 	page_free(pp0);
@@ -1037,9 +1467,7 @@ check_page_alloc(void)
 	page_free(pp2);
 
 	// number of free pages should be the same
-	for (pp = page_free_list; pp; pp = pp->pp_link)
-		--nfree;
-	assert(nfree == 0);
+	assert(check_page_nfree() == nfree);
 
 	cprintf("check_page_alloc() succeeded!\n");
 }
@@ -1152,8 +1580,7 @@ check_page(void)
 	assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	page_free_list = 0;
+	fl = check_page_steal();
 
 	// should be no free memory
 	assert(!page_alloc(0));
@@ -1273,7 +1700,7 @@ check_page(void)
 	pp0->pp_ref = 0;
 
 	// give free list back
-	page_free_list = fl;
+	check_page_unsteal(fl);
 
 	// free the pages we took
 	page_free(pp0);
@@ -1329,7 +1756,8 @@ static void
 check_kmalloc(void)
 {
 	uint32_t nsnaps = 5;
-	int i;
+	int i, nfree;
+	void *big[64];
 
 	struct Snapshot* snaps = (struct Snapshot*) kmalloc(nsnaps * sizeof(struct Snapshot));
 	memset(snaps, 0, nsnaps * sizeof(struct Snapshot));
@@ -1347,5 +1775,76 @@ check_kmalloc(void)
 
 	kfree(snaps);
 
+	// the heap grows past what one arena holds, and gives all of
+	// it back once everything is freed
+	nfree = check_page_nfree();
+	assert(kheap_narenas == 0 && kheap_npages == 0);
+	for(i=0; i<64; ++i)
+	{
+		assert((big[i] = kmalloc(PGSIZE)));
+		memset(big[i], i, PGSIZE);
+	}
+	assert(kheap_npages >= 64 && kheap_narenas > 1);
+	assert(check_page_nfree() == nfree - kheap_npages);
+	for(i=0; i<64; ++i)
+	{
+		assert(((char*) big[i])[PGSIZE - 1] == (char) i);
+		kfree(big[i]);
+	}
+	assert(kheap_narenas == 0 && kheap_npages == 0);
+	assert(check_page_nfree() == nfree);
+
+	// too big for any arena
+	assert(!kmalloc(PTSIZE));
+
 	cprintf("check_kmalloc() succeeded!\n");
+}
+
+static void
+check_kmem_cache(void)
+{
+	struct KmemCache *cp;
+	struct SavedPage *sp, *list = NULL;
+	int i, n, nfree;
+
+	nfree = check_page_nfree();
+	assert((cp = kmem_cache_create("check", sizeof(struct SavedPage))));
+	assert(cp->kc_size >= sizeof(struct SavedPage) && cp->kc_size % 8 == 0);
+	assert(!kmem_cache_create("too big", PGSIZE));
+
+	// fill three slabs and a bit
+	n = 3 * cp->kc_perslab + 1;
+	for (i = 0; i < n; i++) {
+		assert((sp = kmem_cache_alloc(cp)));
+		// objects must not overlap
+		memset(sp, 0x55, cp->kc_size);
+		sp->next = list;
+		list = sp;
+	}
+	assert(cp->kc_inuse == n && cp->kc_maxinuse == n);
+	assert(cp->kc_nslabs == 4);
+	assert(cp->kc_full && cp->kc_partial && !cp->kc_empty);
+
+	// freed objects are reused before a new slab is made
+	sp = list;
+	list = list->next;
+	kmem_cache_free(cp, sp);
+	assert(kmem_cache_alloc(cp) == sp);
+	sp->next = list;
+	list = sp;
+
+	// emptying the cache keeps one spare slab
+	while ((sp = list)) {
+		list = sp->next;
+		kmem_cache_free(cp, sp);
+	}
+	assert(cp->kc_inuse == 0 && cp->kc_nslabs == 1 && cp->kc_empty);
+	assert(cp->kc_nalloc == n + 1 && cp->kc_nfree == n + 1);
+	assert(cp->kc_nslabs_created == 4 && cp->kc_nslabs_destroyed == 3);
+
+	kmem_cache_destroy(cp);
+	assert(!cp->kc_name);
+	assert(check_page_nfree() == nfree);
+
+	cprintf("check_kmem_cache() succeeded!\n");
 }
\ No newline at end of file
@@ -51,16 +51,35 @@ enum {
 	ALLOC_ZERO = 1<<0,
 };
 
+// The largest block page_alloc_order hands out is 2^PAGE_MAX_ORDER
+// pages, one 4MB superpage.
+#define PAGE_MAX_ORDER	10
+
 void	mem_init(void);
 void    mem_init_percpu(void);
 void	page_init(void);
 struct PageInfo *page_alloc(int alloc_flags);
+struct PageInfo *page_alloc_order(int order, int alloc_flags);
 void	page_free(struct PageInfo *pp);
+void	page_free_order(struct PageInfo *pp, int order);
 int	page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
 struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
 
+// Counters for the pool of pre-zeroed pages that serves
+// page_alloc(ALLOC_ZERO); see the monitor's "zeropool" command.
+struct PageZeroStats {
+	int pz_npages;		// Pages in the pool now
+	int pz_target;		// Pages idle CPUs fill it up to
+	uint32_t pz_hits;	// ALLOC_ZERO requests the pool served
+	uint32_t pz_misses;	// ALLOC_ZERO requests that found it dry
+	uint32_t pz_filled;	// Pages zeroed by idle CPUs
+};
+
+int	page_zero_fill(void);
+void	page_zero_stats(struct PageZeroStats *st, bool reset);
+
 void	tlb_invalidate(pde_t *pgdir, void *va);
 
 int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
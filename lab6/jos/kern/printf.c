@@ -5,6 +5,10 @@
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
 
+#include <kern/console.h>
+#include <kern/spinlock.h>
+
+extern const char *panicstr;
 
 static void
 putch(int ch, int *cnt)
@@ -17,8 +21,16 @@ int
 vcprintf(const char *fmt, va_list ap)
 {
 	int cnt = 0;
+	// Once the kernel has panicked, print without cons_lock: the
+	// panicking CPU may hold it already, or another CPU may have
+	// stopped for good while holding it.
+	bool locked = !panicstr;
 
+	if (locked)
+		spin_lock(&cons_lock);
 	vprintfmt((void*)putch, &cnt, fmt, ap);
+	if (locked)
+		spin_unlock(&cons_lock);
 	return cnt;
 }
 
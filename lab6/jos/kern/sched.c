@@ -1,84 +1,479 @@
 #include <inc/assert.h>
 #include <inc/x86.h>
+#include <inc/error.h>
 #include <kern/spinlock.h>
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/event.h>
 
 void sched_halt(void);
+void sched_switch(void);
+void sched_kick(int cpu);
+
+// Protects the run queues and the scheduling state of every env:
+// env_status, env_nactive, which env each CPU has loaded (cpu_env),
+// and the fields in struct Env's scheduler block.
+static struct spinlock runqueue_lock = SPINLOCK_INIT(runqueue_lock);
+
+// Per-CPU run queues of ENV_RUNNABLE environments, linked through
+// env_rq_next/env_rq_prev.  An env queued here sits on the queue of
+// the CPU named by its env_cpunum, normally the CPU it last ran on.
+// Each queue keeps one list per priority level; an env is kept on the
+// list for its effective priority.
+//
+// Within a level, envs share the CPU by stride scheduling: each env's
+// env_pass grows by the cycles it runs, scaled down by its weight, and
+// the env with the lowest pass runs next.  Lists are kept sorted by
+// pass, ties in FIFO order.  rq_pass is the pass of the env this CPU
+// last picked; an env joining the queue with a lower pass (new, or
+// back from blocking) starts there, so it can't use credit saved up
+// while it wasn't competing to monopolize the CPU.  Each queue's
+// rq_pass advances on its own, so an env moving to another CPU has its
+// pass rebased onto that CPU's rq_pass (see sched_migrate).
+struct Runqueue {
+	struct Env *rq_head[NENVPRIO];
+	struct Env *rq_tail[NENVPRIO];
+	int rq_len;
+	uint64_t rq_pass;
+};
+
+static struct Runqueue runqueues[NCPU];
+
+// An env that left its CPU less than this many cycles ago probably
+// still has a warm cache there, so we prefer not to migrate it.
+#define SCHED_HOT_CYCLES	2000000
+
+void
+sched_lock(void)
+{
+	spin_lock(&runqueue_lock);
+}
+
+void
+sched_unlock(void)
+{
+	spin_unlock(&runqueue_lock);
+
+	// Normally we wouldn't need to do this, but QEMU only runs
+	// one CPU at a time and has a long time-slice.  Without the
+	// pause, this CPU is likely to reacquire the lock before
+	// another CPU has even been given a chance to acquire it.
+	asm volatile("pause");
+}
+
+// Return true if e may run on CPU 'cpu'.
+static bool
+sched_allowed(struct Env *e, int cpu)
+{
+	return cpu >= 0 && cpu < ncpu && (e->env_cpumask & (1 << cpu));
+}
+
+// Return true if some CPU other than this one has e loaded: it is
+// running there, or it stopped running there and that CPU has not yet
+// switched to another env and page directory.  Such an env may be
+// runnable again already, but must not be picked, and must not be
+// freed, until that CPU is done with it.
+bool
+sched_loaded_elsewhere(struct Env *e)
+{
+	int i;
+
+	for (i = 0; i < ncpu; i++)
+		if (i != cpunum() && cpus[i].cpu_env == e)
+			return true;
+	return false;
+}
+
+// This CPU has just switched away from 'old'.  If old was made
+// runnable while still loaded here, a CPU may have passed it over, so
+// kick the CPU whose queue it is on.  Returns true if old was destroyed
+// while loaded here, in which case the caller must free it once it has
+// dropped the scheduler lock.
+bool
+sched_unload(struct Env *old)
+{
+	if (old->env_status == ENV_RUNNABLE)
+		sched_kick(old->env_cpunum);
+	return old->env_status == ENV_DYING;
+}
+
+// Make CPU 'cpu' look at its run queue and at what it is running
+// now, rather than at its next timer interrupt, which may never come.
+void
+sched_kick(int cpu)
+{
+	if (cpu != cpunum())
+		lapic_ipi_cpu(cpu, IRQ_OFFSET + IRQ_RESCHED);
+}
+
+// Make CPU 'cpu' e's home.  e's pass only means something next to the
+// rq_pass of the queue it was on, so carry over its lead on that queue
+// to the new one; otherwise it would starve behind, or hog, the envs
+// there until the two queues' passes met.  An env that was behind
+// starts level, as sched_enqueue() would have it anyway.  e must not
+// be queued.
+void
+sched_migrate(struct Env *e, int cpu)
+{
+	uint64_t lead = 0, old = runqueues[e->env_cpunum].rq_pass;
+
+	if (e->env_cpunum == cpu)
+		return;
+	if (e->env_pass > old)
+		lead = e->env_pass - old;
+	e->env_pass = runqueues[cpu].rq_pass + lead;
+	e->env_cpunum = cpu;
+}
+
+// Insert e into its CPU's run queue, after every env of its priority
+// with a pass no greater than its own.  If e may not run on the CPU it
+// last ran on, it moves to the least loaded CPU it may use.
+//
+// A CPU whose queue was empty is either halted or running with no
+// timer armed, so it gets kicked.  A queue that already had a backlog
+// is worth kicking a halted CPU for, so that it can steal.
+void
+sched_enqueue(struct Env *e)
+{
+	struct Runqueue *rq;
+	struct Env *prev;
+	int prio = e->env_eff_priority;
+	int i, cpu;
+
+	if (!sched_allowed(e, e->env_cpunum)) {
+		cpu = -1;
+		for (i = 0; i < ncpu; i++)
+			if (sched_allowed(e, i) && (cpu < 0 ||
+			    runqueues[i].rq_len < runqueues[cpu].rq_len))
+				cpu = i;
+		assert(cpu >= 0);
+		sched_migrate(e, cpu);
+	}
+	rq = &runqueues[e->env_cpunum];
+
+	if (e->env_pass < rq->rq_pass)
+		e->env_pass = rq->rq_pass;
+
+	// Usually e has run the most recently, so search from the tail.
+	for (prev = rq->rq_tail[prio]; prev; prev = prev->env_rq_prev)
+		if (prev->env_pass <= e->env_pass)
+			break;
+
+	e->env_rq_prev = prev;
+	if (prev) {
+		e->env_rq_next = prev->env_rq_next;
+		prev->env_rq_next = e;
+	} else {
+		e->env_rq_next = rq->rq_head[prio];
+		rq->rq_head[prio] = e;
+	}
+	if (e->env_rq_next)
+		e->env_rq_next->env_rq_prev = e;
+	else
+		rq->rq_tail[prio] = e;
+
+	if (rq->rq_len++ == 0)
+		sched_kick(e->env_cpunum);
+	else
+		for (i = 0; i < ncpu; i++)
+			if (cpus[i].cpu_status == CPU_HALTED &&
+			    sched_allowed(e, i)) {
+				sched_kick(i);
+				break;
+			}
+}
+
+// Unlink e from the run queue it is on.
+void
+sched_dequeue(struct Env *e)
+{
+	struct Runqueue *rq = &runqueues[e->env_cpunum];
+	int prio = e->env_eff_priority;
+
+	if (e->env_rq_prev)
+		e->env_rq_prev->env_rq_next = e->env_rq_next;
+	else
+		rq->rq_head[prio] = e->env_rq_next;
+	if (e->env_rq_next)
+		e->env_rq_next->env_rq_prev = e->env_rq_prev;
+	else
+		rq->rq_tail[prio] = e->env_rq_prev;
+	e->env_rq_next = e->env_rq_prev = NULL;
+	rq->rq_len--;
+}
+
+// Change e's effective priority, moving it to the matching list if it
+// is queued.  Called with the scheduler lock held, as are the other
+// functions here that change an env's scheduling state.
+void
+sched_set_priority(struct Env *e, int prio)
+{
+	if (e->env_eff_priority == prio)
+		return;
+
+	if (e->env_status == ENV_RUNNABLE) {
+		sched_dequeue(e);
+		e->env_eff_priority = prio;
+		sched_enqueue(e);
+	} else
+		e->env_eff_priority = prio;
+}
+
+// Restrict e to the CPUs in cpumask, moving it off a CPU it may no
+// longer use if it is queued.  An env running on a CPU it may no longer
+// use moves the next time that CPU schedules.
+// Returns 0 on success, -E_INVAL if cpumask names no existing CPU.
+int
+sched_set_affinity(struct Env *e, uint32_t cpumask)
+{
+	cpumask &= (1 << ncpu) - 1;
+	if (!cpumask)
+		return -E_INVAL;
+
+	if (e->env_status == ENV_RUNNABLE) {
+		sched_dequeue(e);
+		e->env_cpumask = cpumask;
+		sched_enqueue(e);
+	} else
+		e->env_cpumask = cpumask;
+
+	if (e->env_status == ENV_RUNNING && !sched_allowed(e, e->env_cpunum))
+		sched_kick(e->env_cpunum);
+	return 0;
+}
+
+// Charge e, which has been running in user mode on this CPU since
+// env_run() last stamped cpu_run_tsc, for that time.
+void
+sched_charge(struct Env *e)
+{
+	uint64_t delta = read_tsc() - thiscpu->cpu_run_tsc;
+
+	e->env_cycles += delta;
+	e->env_pass += delta * ENV_WEIGHT_DEFAULT / e->env_weight;
+}
+
+// e, running on this CPU, is giving up the CPU voluntarily.  An env
+// that yields right away has hardly been charged, so without help it
+// would still have the lowest pass and be picked again at once; move
+// it behind the envs waiting at its priority instead.
+void
+sched_skip(struct Env *e)
+{
+	struct Env *head = runqueues[cpunum()].rq_head[e->env_eff_priority];
+
+	if (head && e->env_pass < head->env_pass)
+		e->env_pass = head->env_pass;
+}
+
+// Program this CPU's timer before it returns to user mode.  The env
+// about to run only needs to be preempted after a tick if another env
+// is waiting for this CPU; sched_enqueue() kicks us when one arrives.
+// The boot CPU also wakes up for the next event channel timer.
+void
+sched_set_timer(void)
+{
+	uint32_t nticks = 0;
+
+	if (thiscpu == bootcpu)
+		nticks = evt_timer_ticks();
+	if (runqueues[cpunum()].rq_len > 0)
+		nticks = 1;
+	lapic_timer_deadline(nticks);
+}
+
+// Make e, which curenv has just woken up, runnable.  Returns true if
+// the caller should switch straight to e with env_run(), without a trip
+// through the run queue: e may run on this CPU and is at least as
+// urgent as curenv.  curenv then goes back on the queue and e runs on
+// what is left of curenv's tick.  The caller must do this before it
+// drops the scheduler lock, and with curenv's system call return value
+// already set, since the switch doesn't return.
+bool
+sched_wakeup(struct Env *e)
+{
+	bool handoff = e->env_status == ENV_NOT_RUNNABLE &&
+		sched_allowed(e, cpunum()) &&
+		e->env_eff_priority >= curenv->env_eff_priority &&
+		!sched_loaded_elsewhere(e);
+
+	// queue e here if we're about to run it, so nobody else is
+	// woken up to run it
+	if (handoff)
+		sched_migrate(e, cpunum());
+	__env_set_status(e, ENV_RUNNABLE);
+	return handoff;
+}
+
+// Make e, which curenv has just woken up, runnable while curenv keeps
+// this CPU.  If e would only queue up behind curenv here, it goes to a
+// halted CPU it may run on instead, which sched_enqueue() then kicks.
+void
+sched_wakeup_elsewhere(struct Env *e)
+{
+	int i;
+
+	if (e->env_cpunum == cpunum() || !sched_allowed(e, e->env_cpunum))
+		for (i = 0; i < ncpu; i++)
+			if (cpus[i].cpu_status == CPU_HALTED &&
+			    sched_allowed(e, i)) {
+				sched_migrate(e, i);
+				break;
+			}
+	__env_set_status(e, ENV_RUNNABLE);
+}
+
+// Return the env that should run next from rq: the first env on the
+// highest-priority non-empty list that no other CPU still has loaded.
+// Returns NULL if there is none.
+static struct Env *
+runqueue_pick(struct Runqueue *rq)
+{
+	struct Env *e;
+	int prio;
+
+	for (prio = NENVPRIO - 1; prio >= 0; prio--)
+		for (e = rq->rq_head[prio]; e; e = e->env_rq_next)
+			if (!sched_loaded_elsewhere(e))
+				return e;
+	return NULL;
+}
+
+// Pick an env that CPU 'me' may take from victim's queue.  Envs near
+// the head of a list have been waiting longest, so they are the
+// coldest and the cheapest to move.  A running victim whose only
+// queued env is cache-hot keeps it: its CPU will get to it shortly.
+static struct Env *
+sched_steal_from(struct Runqueue *victim, int me, uint64_t now)
+{
+	struct Env *e, *fallback = NULL;
+	int prio;
+
+	for (prio = NENVPRIO - 1; prio >= 0; prio--)
+		for (e = victim->rq_head[prio]; e; e = e->env_rq_next) {
+			if (!sched_allowed(e, me) || sched_loaded_elsewhere(e))
+				continue;
+			if (now - e->env_sched_tsc >= SCHED_HOT_CYCLES)
+				return e;
+			// the most urgent env that would otherwise
+			// wait the longest
+			if (!fallback || fallback->env_eff_priority == prio)
+				fallback = e;
+		}
+
+	// Everything is hot, but the victim has a backlog or is halted
+	// and won't look at its queue until its next tick.
+	if (victim->rq_len > 1 ||
+	    cpus[victim - runqueues].cpu_status == CPU_HALTED)
+		return fallback;
+	return NULL;
+}
+
+// Find an env for the idle CPU 'me' to take from the busiest other CPU
+// that has one it may run.
+// Returns NULL if there is nothing worth stealing.
+static struct Env *
+sched_steal(int me)
+{
+	struct Env *e, *best = NULL;
+	uint64_t now = read_tsc();
+	int i;
+
+	for (i = 0; i < ncpu; i++) {
+		if (i == me || runqueues[i].rq_len == 0)
+			continue;
+		if (best && runqueues[i].rq_len <= runqueues[best->env_cpunum].rq_len)
+			continue;
+		if ((e = sched_steal_from(&runqueues[i], me, now)))
+			best = e;
+	}
+	return best;
+}
 
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
 {
-	struct Env *idle;
+	sched_lock();
+	sched_switch();
+}
+
+// The body of sched_yield(), for callers already holding the scheduler
+// lock.  Does not return.
+void
+sched_switch(void)
+{
+	struct Runqueue *rq;
+	struct Env *next;
+	bool running;
 
-	// Implement simple round-robin scheduling.
-	//
-	// Search through 'envs' for an ENV_RUNNABLE environment in
-	// circular fashion starting just after the env this CPU was
-	// last running.  Switch to the first such environment found.
+	// Run the head of the highest-priority non-empty list on this
+	// CPU's run queue, which is the env of that priority with the
+	// lowest pass.  env_run() puts the env we were running back in
+	// its list, in order of its newly charged pass.
 	//
-	// If no envs are runnable, but the environment previously
-	// running on this CPU is still ENV_RUNNING, it's okay to
-	// choose that environment.
+	// The environment previously running on this CPU, if it is
+	// still ENV_RUNNING, keeps the CPU unless something queued here
+	// has a higher priority, or the same priority and a pass no
+	// greater than its own.  Envs running on other CPUs are never
+	// on a run queue, so they can't be picked by accident.
 	//
-	// Never choose an environment that's currently running on
-	// another CPU (env_status == ENV_RUNNING). If there are
-	// no runnable environments, simply drop through to the code
-	// below to halt the cpu.
+	// Only when this CPU would otherwise halt do we steal work
+	// from another CPU's queue.
+	rq = &runqueues[cpunum()];
+	running = curenv && curenv->env_status == ENV_RUNNING;
 
-	// LAB 4: Your code here.
-	struct Env *cur;
+	// An env that may no longer run here goes back to a run queue
+	// of a CPU it may use.  It stays loaded here, so nobody else
+	// runs it until we have switched away from it.
+	if (running && !sched_allowed(curenv, cpunum())) {
+		__env_set_status(curenv, ENV_RUNNABLE);
+		running = false;
+	}
 
-	// loop from curenv+1 to curenv over the whole envs array
-	int start_idx = curenv ? curenv - envs + 1 : 0;
-	int end_idx = curenv ? curenv - envs + NENV : NENV-1;
-	int i;
+	next = runqueue_pick(rq);
 
-	idle = NULL;
-	for(i = start_idx; i <= end_idx; ++i)
-	{
-		cur = envs + (i % NENV);
-		
-		// either we are to be scheduled again (our status should be RUNNING) 
-		// or we are to yield to another runnable env
-		if((cur == curenv && cur->env_status == ENV_RUNNING) || 
-			cur->env_status == ENV_RUNNABLE)
-		{
-			idle = cur;
-			break;
-		}
+	if (running) {
+		if (!next || next->env_eff_priority < curenv->env_eff_priority ||
+		    (next->env_eff_priority == curenv->env_eff_priority &&
+		     next->env_pass > curenv->env_pass))
+			next = curenv;
+	} else if (!next && (next = sched_steal(cpunum()))) {
+		// Bring it over, rebasing its pass onto ours.
+		sched_dequeue(next);
+		sched_migrate(next, cpunum());
+		sched_enqueue(next);
 	}
 
-	if(!idle)
+	if (next && next->env_pass > rq->rq_pass)
+		rq->rq_pass = next->env_pass;
+
+	if (next)
+		env_run(next);
+	else
 		// sched_halt never returns
 		sched_halt();
-	else
-	{
-		env_run(idle);
-	}
 }
 
 // Halt this CPU when there is nothing to do. Wait until the
 // timer interrupt wakes it up. This function never returns.
+// Called with the scheduler lock held.
 //
 void
 sched_halt(void)
 {
-	int i;
+	struct Env *old = curenv;
+	bool dying;
 
 	// For debugging and testing purposes, if there are no runnable
 	// environments in the system, then drop into the kernel monitor.
-	for (i = 0; i < NENV; i++) {
-		if ((envs[i].env_status == ENV_RUNNABLE ||
-		     envs[i].env_status == ENV_RUNNING ||
-		     envs[i].env_status == ENV_DYING))
-			break;
-	}
-	if (i == NENV) {
+	// Only the boot CPU does, so that monitors on several CPUs don't
+	// fight over the console; any other CPU halts (see below).
+	if (env_nactive == 0 && thiscpu == bootcpu) {
+		sched_unlock();
 		cprintf("No runnable environments in the system!\n");
 		while (1)
 			monitor(NULL);
@@ -87,14 +482,33 @@ sched_halt(void)
 	// Mark that no environment is running on this CPU
 	curenv = NULL;
 	lcr3(PADDR(kern_pgdir));
+	dying = old && sched_unload(old);
 
-	// Mark that this CPU is in the HALT state, so that when
-	// timer interupts come in, we know we should re-acquire the
-	// big kernel lock
+	// Mark that this CPU is in the HALT state, so that a CPU that
+	// queues work for us knows to kick us awake.
 	xchg(&thiscpu->cpu_status, CPU_HALTED);
 
-	// Release the big kernel lock as if we were "leaving" the kernel
-	unlock_kernel();
+	// Nothing to preempt; sched_enqueue() kicks us when work arrives.
+	// The boot CPU still has event channel timers to fire.
+	lapic_timer_deadline(thiscpu == bootcpu ? evt_timer_ticks() : 0);
+
+	sched_unlock();
+
+	if (dying) {
+		env_lock(old);
+		env_free(old);
+		env_unlock(old);
+	}
+
+	// Once the last env is gone, wake the boot CPU to run the monitor.
+	if (env_nactive == 0 && thiscpu != bootcpu)
+		sched_kick(bootcpu->cpu_id);
+
+	// Spend the idle time zeroing pages for page_alloc(ALLOC_ZERO),
+	// until there is something to run.  An env queued meanwhile
+	// also sent us an IPI, which arrives as soon as we sti.
+	while (runqueues[cpunum()].rq_len == 0 && page_zero_fill())
+		;
 
 	// Reset stack pointer, enable interrupts and then halt.
 	asm volatile (
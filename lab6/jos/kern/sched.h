@@ -6,7 +6,37 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
-// This function does not return.
+#include <inc/types.h>
+
+struct Env;
+
+// The scheduler lock protects the run queues and every env's
+// scheduling state, including env_status.  It nests inside env locks.
+void sched_lock(void);
+void sched_unlock(void);
+
+// These functions do not return.  sched_switch() is sched_yield() for
+// callers already holding the scheduler lock.
 void sched_yield(void) __attribute__((noreturn));
+void sched_switch(void) __attribute__((noreturn));
+
+// Run queue maintenance, called with the scheduler lock held.  An env
+// is on a run queue exactly when its status is ENV_RUNNABLE; use
+// env_set_status() rather than calling the first two directly.
+void sched_enqueue(struct Env *e);
+void sched_dequeue(struct Env *e);
+void sched_set_priority(struct Env *e, int prio);
+void sched_migrate(struct Env *e, int cpu);
+int sched_set_affinity(struct Env *e, uint32_t cpumask);
+bool sched_wakeup(struct Env *e);
+void sched_wakeup_elsewhere(struct Env *e);
+bool sched_loaded_elsewhere(struct Env *e);
+bool sched_unload(struct Env *old);
+void sched_skip(struct Env *e);
+void sched_set_timer(void);
+
+// These need no lock.
+void sched_charge(struct Env *e);
+void sched_kick(int cpu);
 
 #endif	// !JOS_KERN_SCHED_H
@@ -9,12 +9,7 @@
 #include <kern/spinlock.h>
 #include <kern/kdebug.h>
 
-// The big kernel lock
-struct spinlock kernel_lock = {
-#ifdef DEBUG_SPINLOCK
-	.name = "kernel_lock"
-#endif
-};
+struct spinlock *spinlocks;
 
 #ifdef DEBUG_SPINLOCK
 // Record the current call stack in pcs[] by following the %ebp chain.
@@ -39,20 +34,39 @@ get_caller_pcs(uint32_t pcs[])
 static int
 holding(struct spinlock *lock)
 {
-	return lock->locked && lock->cpu == thiscpu;
+	return lock->next != lock->owner && lock->cpu == thiscpu;
 }
 #endif
 
 void
 __spin_initlock(struct spinlock *lk, char *name)
 {
-	lk->locked = 0;
-#ifdef DEBUG_SPINLOCK
+	lk->next = lk->owner = 0;
 	lk->name = name;
+	lk->nacquire = lk->ncontended = 0;
+	lk->spin_cycles = 0;
+	lk->link = NULL;
+	lk->listed = 0;
+#ifdef DEBUG_SPINLOCK
 	lk->cpu = 0;
 #endif
 }
 
+// Put lk, which we hold, on the list of all locks.  Other CPUs may be
+// adding other locks at the same time.
+static void
+spin_list(struct spinlock *lk)
+{
+	struct spinlock *head;
+
+	lk->listed = 1;
+	do {
+		head = spinlocks;
+		lk->link = head;
+	} while (cmpxchg((volatile uint32_t *) &spinlocks,
+			 (uint32_t) head, (uint32_t) lk) != (uint32_t) head);
+}
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
@@ -65,11 +79,25 @@ spin_lock(struct spinlock *lk)
 		panic("CPU %d cannot acquire %s: already holding", cpunum(), lk->name);
 #endif
 
-	// The xchg is atomic.
+	unsigned ticket;
+	uint64_t start;
+
+	// The xadd is atomic.
 	// It also serializes, so that reads after acquire are not
-	// reordered before it. 
-	while (xchg(&lk->locked, 1) != 0)
-		asm volatile ("pause");
+	// reordered before it.  Each waiter spins reading owner and only
+	// the releasing CPU writes it, so the waiters don't fight over
+	// the cache line.
+	ticket = xadd(&lk->next, 1);
+	if (lk->owner != ticket) {
+		start = read_tsc();
+		while (lk->owner != ticket)
+			asm volatile ("pause");
+		lk->spin_cycles += read_tsc() - start;
+		lk->ncontended++;
+	}
+	lk->nacquire++;
+	if (!lk->listed)
+		spin_list(lk);
 
 	// Record info about lock acquisition for debugging.
 #ifdef DEBUG_SPINLOCK
@@ -107,10 +135,10 @@ spin_unlock(struct spinlock *lk)
 	lk->cpu = 0;
 #endif
 
-	// The xchg instruction is atomic (i.e. uses the "lock" prefix) with
-	// respect to any other instruction which references the same memory.
-	// x86 CPUs will not reorder loads/stores across locked instructions
-	// (vol 3, 8.2.2). Because xchg() is implemented using asm volatile,
-	// gcc will not reorder C statements across the xchg.
-	xchg(&lk->locked, 0);
+	// Only the holder writes owner, so a plain increment hands the
+	// lock to the next ticket.  x86 CPUs don't reorder stores with
+	// earlier loads or stores (vol 3, 8.2.2), and the "memory"
+	// clobber keeps gcc from moving the critical section past it.
+	asm volatile("" : : : "memory");
+	lk->owner++;
 }
@@ -7,12 +7,23 @@
 #define DEBUG_SPINLOCK
 
 // Mutual exclusion lock.
+// A ticket lock: each CPU takes the next ticket and waits until the
+// lock serves it, so waiters get the lock in FIFO order.
 struct spinlock {
-	unsigned locked;       // Is the lock held?
+	volatile unsigned next;   // The next ticket to hand out
+	volatile unsigned owner;  // The ticket holding the lock
+	char *name;               // Name of lock.
+
+	// Contention statistics, updated while holding the lock.
+	// See the monitor's "locks" command.
+	uint32_t nacquire;        // Times acquired
+	uint32_t ncontended;      // Times acquired after waiting
+	uint64_t spin_cycles;     // TSC cycles spent waiting
+	struct spinlock *link;    // Next lock on the list of all locks
+	bool listed;              // Is the lock on that list?
 
 #ifdef DEBUG_SPINLOCK
 	// For debugging:
-	char *name;            // Name of lock.
 	struct CpuInfo *cpu;   // The CPU holding the lock.
 	uintptr_t pcs[10];     // The call stack (an array of program counters)
 	                       // that locked the lock.
@@ -25,24 +36,24 @@ void spin_unlock(struct spinlock *lk);
 
 #define spin_initlock(lock)   __spin_initlock(lock, #lock)
 
-extern struct spinlock kernel_lock;
-
-static inline void
-lock_kernel(void)
-{
-	spin_lock(&kernel_lock);
-}
-
-static inline void
-unlock_kernel(void)
-{
-	spin_unlock(&kernel_lock);
-
-	// Normally we wouldn't need to do this, but QEMU only runs
-	// one CPU at a time and has a long time-slice.  Without the
-	// pause, this CPU is likely to reacquire the lock before
-	// another CPU has even been given a chance to acquire it.
-	asm volatile("pause");
-}
+// Static initializer, as in
+//	static struct spinlock foo_lock = SPINLOCK_INIT(foo_lock);
+#define SPINLOCK_INIT(lock)   { .name = #lock }
+
+// Every lock that has been acquired at least once.
+extern struct spinlock *spinlocks;
+
+// There is no big kernel lock.  Each subsystem has its own:
+//	env locks, env_free_lock, snapshot_lock	kern/env.c
+//	ipc_wait_lock				kern/env.c
+//	runqueue_lock (the scheduler lock)	kern/sched.c
+//	pc_locks, page_lock, page_zero_lock	kern/pmap.c
+//	kmalloc_lock				kern/kmalloc.c
+//	kmem_lock, one kc_lock per object cache	kern/kmem.c
+//	cons_lock, cons_in_lock			kern/console.c
+//	e1000_lock				kern/e1000.c
+//	evt_lock				kern/event.c
+// Where one is taken inside another, env locks come first, then
+// ipc_wait_lock, then the scheduler lock, then the rest.
 
 #endif
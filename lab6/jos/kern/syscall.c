@@ -11,9 +11,10 @@
 #include <kern/syscall.h>
 #include <kern/console.h>
 #include <kern/sched.h>
-#include <kern/kmalloc.h>
+#include <kern/kmem.h>
 #include <kern/time.h>
 #include <kern/e1000.h>
+#include <kern/event.h>
 
 #define debug 0
 
@@ -26,10 +27,12 @@ sys_cputs(const char *s, size_t len)
 	// Check that the user has permission to read memory [s, s+len).
 	// Destroy the environment if not.
 	// LAB 3: Your code here.
+	env_lock(curenv);
 	user_mem_assert(curenv, s, len, 0);
 
 	// Print the string supplied by the user.
 	cprintf("%.*s", len, s);
+	env_unlock(curenv);
 }
 
 // Read a character from the system console without blocking.
@@ -58,7 +61,7 @@ sys_env_destroy(envid_t envid)
 	int r;
 	struct Env *e;
 
-	if ((r = envid2env(envid, &e, 1)) < 0)
+	if ((r = envid2env_lock(envid, &e, 1)) < 0)
 		return r;
 	
 	if(debug)
@@ -70,6 +73,7 @@ sys_env_destroy(envid_t envid)
 	}
 
 	env_destroy(e);
+	env_unlock(e);
 	return 0;
 }
 
@@ -77,7 +81,9 @@ sys_env_destroy(envid_t envid)
 static void
 sys_yield(void)
 {
-	sched_yield();
+	sched_lock();
+	sched_skip(curenv);
+	sched_switch();
 }
 
 // Allocate a page of memory and map it at 'va' with permission
@@ -112,17 +118,25 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	if(perm & ~PTE_SYSCALL)
 		return -E_INVAL;
 
+	pinfo = page_alloc(ALLOC_ZERO);
+	if(!pinfo)
+		return -E_NO_MEM;
+
 	//if environment envid doesn't currently exist, or the caller doesn't have permission to change envid.
-	r = envid2env(envid, &e, 1);
+	r = envid2env_lock(envid, &e, 1);
 	if(r < 0)
-		return r;
+		goto bad;
 
-	pinfo = page_alloc(ALLOC_ZERO);
 	r = page_insert(e->env_pgdir, pinfo, va, perm);
+	env_unlock(e);
 	if(r < 0)
-		return r;
+		goto bad;
 	
 	return 0;
+
+bad:
+	page_free(pinfo);
+	return r;
 }
 
 // Allocate a new environment.
@@ -139,7 +153,15 @@ sys_exofork(void)
 	if(r < 0)
 		return r;
 
-	e->env_status = ENV_NOT_RUNNABLE;
+	env_set_status(e, ENV_NOT_RUNNABLE);
+
+	// the child inherits our base priority, CPU affinity and weight
+	sched_lock();
+	e->env_priority = curenv->env_priority;
+	sched_set_priority(e, e->env_priority);
+	e->env_cpumask = curenv->env_cpumask;
+	e->env_weight = curenv->env_weight;
+	sched_unlock();
 
 	//copy register states
 	e->env_tf = curenv->env_tf;
@@ -165,15 +187,20 @@ sys_env_snapshot(envid_t envid)
 	physaddr_t pa;
 
 	dummy = NULL;
-	if ((r = envid2env(envid, &e, 1)) < 0)
+	if ((r = envid2env_lock(envid, &e, 1)) < 0)
 		return r;
-	if ((r = snapshot_alloc(&ssid) < 0))
+	if ((r = snapshot_alloc(&ssid, e->env_id)) < 0) {
+		env_unlock(e);
 		return r;
+	}
 
-	ss = id2snapshot(ssid);
-	ss->envid = envid;
+	ss = id2snapshot(ssid, e->env_id);
 	
-	dummy = kmalloc(sizeof(struct SavedPage));
+	if (!(dummy = savedpage_alloc())) {
+		snapshot_free(ssid);
+		env_unlock(e);
+		return -E_NO_MEM;
+	}
 	cur = dummy;
 
 	// save address space
@@ -181,12 +208,12 @@ sys_env_snapshot(envid_t envid)
 	{
 		if(page_lookup(e->env_pgdir, (void*)va, &pte))
 		{
-			cur->next = kmalloc(sizeof(struct SavedPage));
+			if (!(cur->next = savedpage_alloc()))
+				goto bad;
 
 			cur = cur->next;
 			cur->page_vm = va;
 			cur->page_perm = PTE_FLAGS(*pte);
-			cur->next = NULL;
 
 			pa = PTE_ADDR(*pte);
 
@@ -201,7 +228,7 @@ sys_env_snapshot(envid_t envid)
 	}
 	
 	cur = dummy->next;
-	kfree(dummy);
+	savedpage_free(dummy);
 
 	ss->saved_pages = cur;
 
@@ -215,6 +242,7 @@ sys_env_snapshot(envid_t envid)
 	// not used in this case
 	ss->utf.utf_fault_va = 0;
 
+	env_unlock(e);
 	return ssid;
 
 bad:
@@ -222,6 +250,7 @@ bad:
 	ss->saved_pages = dummy;
 	snapshot_free(ssid);
 
+	env_unlock(e);
 	return -E_NO_MEM;
 }
 
@@ -229,39 +258,47 @@ bad:
 static int
 sys_env_resume(envid_t envid, snapshotid_t snapshotid)
 {
-	void _savedpages_free(struct SavedPage* cur);
-
 	int i, r;
 	struct Env *e;
 	struct Snapshot *ss;
 	struct SavedPage *cur, *new_page_start, *new_page;
 	struct PageInfo *pinfo;
 
-	if ((r = envid2env(envid, &e, 1)) < 0)
+	if ((r = envid2env_lock(envid, &e, 1)) < 0)
 		return r;
 
-	ss = id2snapshot(snapshotid);
-	if (!ss || ss->envid != envid)
+	ss = id2snapshot(snapshotid, e->env_id);
+	if (!ss)
 	{
+		env_unlock(e);
 		return -E_INVAL;
 	}
 
 	// allocate all necessary pages and store them in a linked list before doing anything to the env
 	// so that we don't end up with intermediate states
 	cur = ss->saved_pages;
-	new_page_start = kmalloc(sizeof(struct SavedPage));
+	if (!(new_page_start = savedpage_alloc()))
+	{
+		env_unlock(e);
+		return -E_NO_MEM;
+	}
 	new_page = new_page_start;
 
 	while(cur)
 	{
-		new_page->next = kmalloc(sizeof(struct SavedPage));
+		if (!(new_page->next = savedpage_alloc()))
+		{
+			_savedpages_free(new_page_start);
+			env_unlock(e);
+			return -E_NO_MEM;
+		}
 		new_page = new_page->next;
 
 		new_page->saved_page = page_alloc(0);
 		if(!new_page->saved_page)
 		{
-			new_page->next = NULL;
 			_savedpages_free(new_page_start);
+			env_unlock(e);
 			return -E_NO_MEM;
 		}
 		
@@ -270,6 +307,10 @@ sys_env_resume(envid_t envid, snapshotid_t snapshotid)
 		cur = cur->next;
 	}
 	
+	// e must not run again until it has been rolled back
+	if (e != curenv)
+		env_set_status(e, ENV_NOT_RUNNABLE);
+
 	//free address space
 	env_flush_addr_space(e);
 
@@ -281,7 +322,8 @@ sys_env_resume(envid_t envid, snapshotid_t snapshotid)
 		if((r = page_insert(e->env_pgdir, new_page->saved_page, (void*) cur->page_vm, cur->page_perm)) < 0)
 		{
 			_savedpages_free(new_page_start);
-			env_free(e);
+			env_destroy(e);		// may not return
+			env_unlock(e);
 
 			return r;
 		}
@@ -290,19 +332,26 @@ sys_env_resume(envid_t envid, snapshotid_t snapshotid)
 		new_page = new_page->next;
 	}
 
-	//free dummy node
-	kfree(new_page_start);
+	//free the list, dummy node included; the pages now belong to e
+	while(new_page_start)
+	{
+		new_page = new_page_start->next;
+		savedpage_free(new_page_start);
+		new_page_start = new_page;
+	}
 
 	e->env_tf.tf_eflags = ss->utf.utf_eflags;
 	e->env_tf.tf_esp = ss->utf.utf_esp;
 	e->env_tf.tf_eip = ss->utf.utf_eip;
 	e->env_tf.tf_regs = ss->utf.utf_regs;
 
-	e->env_status = e == curenv ? ENV_RUNNING : ENV_RUNNABLE;
+	env_set_status(e, e == curenv ? ENV_RUNNING : ENV_RUNNABLE);
+	env_unlock(e);
 	return 0;
 
 bad:
 	_savedpages_free(new_page_start);
+	env_unlock(e);
 
 	return -E_NO_MEM;
 }
@@ -323,12 +372,106 @@ sys_env_set_status(envid_t envid, int status)
 	if(status != ENV_RUNNABLE && status != ENV_NOT_RUNNABLE)
 		return -E_INVAL;
 
-	r = envid2env(envid, &e, 1);
+	r = envid2env_lock(envid, &e, 1);
 	if(r < 0)
 		return r;
 	
-	e->env_status = status;
+	env_set_status(e, status);
+	env_unlock(e);
+
+	return 0;
+}
+
+// Set envid's base scheduling priority to prio, which must be between
+// ENV_PRIO_LOW and ENV_PRIO_HIGH.  This also drops any priority the env
+// was inheriting through IPC.  Note that an env whose priority is above
+// every other runnable env keeps the CPU even across sys_yield, so an
+// env may not raise anyone above ENV_PRIO_NORMAL or its own base
+// priority, whichever is higher.  Only the kernel starts envs higher:
+// the file system and network servers, whose children inherit it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if prio is not a valid priority, or is above the
+//		caller's limit.
+static int
+sys_env_set_priority(envid_t envid, int prio)
+{
+	int r;
+	struct Env *e;
+
+	if (prio < 0 || prio >= NENVPRIO)
+		return -E_INVAL;
+	if (prio > ENV_PRIO_NORMAL && prio > curenv->env_priority)
+		return -E_INVAL;
+
+	if ((r = envid2env_lock(envid, &e, 1)) < 0)
+		return r;
 
+	sched_lock();
+	e->env_priority = prio;
+	sched_set_priority(e, prio);
+	sched_unlock();
+	env_unlock(e);
+	return 0;
+}
+
+// Restrict envid to the CPUs whose bits are set in cpumask.
+// If the calling env restricts itself away from the CPU it is
+// running on, it moves before this call returns.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if cpumask contains no existing CPU.
+static int
+sys_env_set_affinity(envid_t envid, uint32_t cpumask)
+{
+	int r;
+	struct Env *e;
+
+	if ((r = envid2env_lock(envid, &e, 1)) < 0)
+		return r;
+
+	sched_lock();
+	r = sched_set_affinity(e, cpumask);
+	sched_unlock();
+	env_unlock(e);
+	if (r < 0)
+		return r;
+
+	if (e == curenv && !(cpumask & (1 << cpunum()))) {
+		curenv->env_tf.tf_regs.reg_eax = 0;
+		sched_yield();
+	}
+	return 0;
+}
+
+// Set envid's fair-share weight.  Runnable envs of the same priority
+// get CPU time in proportion to their weights; a new env has weight
+// ENV_WEIGHT_DEFAULT.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if weight is 0 or greater than ENV_WEIGHT_MAX.
+static int
+sys_env_set_weight(envid_t envid, uint32_t weight)
+{
+	int r;
+	struct Env *e;
+
+	if (weight == 0 || weight > ENV_WEIGHT_MAX)
+		return -E_INVAL;
+
+	if ((r = envid2env_lock(envid, &e, 1)) < 0)
+		return r;
+
+	sched_lock();
+	e->env_weight = weight;
+	sched_unlock();
+	env_unlock(e);
 	return 0;
 }
 
@@ -348,7 +491,7 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	int r;
 	struct Env *e;
 
-	r = envid2env(envid, &e, 1);
+	r = envid2env_lock(envid, &e, 1);
 	if(r < 0)
 		return r;
 
@@ -359,6 +502,7 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	e->env_tf.tf_eflags &= ~FL_IOPL_MASK;
 	e->env_tf.tf_eflags |= FL_IF;
 	e->env_tf = *tf;
+	env_unlock(e);
 
 	return 0;
 
@@ -404,21 +548,19 @@ sys_page_map(envid_t src_envid, void *src_pg,
 		return -E_INVAL;
 
 	// if srcenvid and/or dstenvid doesn't currently exist, or the caller doesn't have permission to change one of them.
-	r = envid2env(src_envid, &src_e, 1);
-	if(r < 0)
-		return r;
-	r = envid2env(dst_envid, &dst_e, 1);
+	r = envid2env_lock2(src_envid, &src_e, dst_envid, &dst_e, 1);
 	if(r < 0)
 		return r;
 	
 	pginfo = page_lookup(src_e->env_pgdir, src_pg, &src_pte);
 	if(!pginfo)
-		return -E_INVAL;
-	
-	if(perm & PTE_W && !(*src_pte & PTE_W))
-		return -E_INVAL;
-	
-	r = page_insert(dst_e->env_pgdir, pginfo, dst_pg, perm);
+		r = -E_INVAL;
+	else if(perm & PTE_W && !(*src_pte & PTE_W))
+		r = -E_INVAL;
+	else
+		r = page_insert(dst_e->env_pgdir, pginfo, dst_pg, perm);
+
+	env_unlock2(src_e, dst_e);
 	if(r < 0)
 		return r;
 
@@ -442,11 +584,12 @@ int	sys_page_unmap(envid_t envid, void *pg)
 	if((uintptr_t) pg >= UTOP || (uintptr_t) pg & (PGSIZE-1))
 		return -E_INVAL;
 
-	r = envid2env(envid, &e, 1);
+	r = envid2env_lock(envid, &e, 1);
 	if(r < 0)
 		return r;
 
 	page_remove(e->env_pgdir, pg);
+	env_unlock(e);
 	return 0;
 }
 
@@ -464,14 +607,144 @@ sys_env_set_pgfault_upcall(envid_t envid, void *func)
 	int r;
 	struct Env* e;
 
-	r = envid2env(envid, &e, 1);
+	r = envid2env_lock(envid, &e, 1);
 	if(r < 0)
 		return r;
 	
 	e->env_pgfault_upcall = func;
+	env_unlock(e);
 	return 0;
 }
 
+// Check the page and permissions a sender offers, as sys_page_alloc
+// would.  Anything will do if srcva >= UTOP, since no page is sent.
+// If perm is IPC_MSG, copy the message at srcva into the sender's
+// env_ipc_sendmsg instead, destroying the sender if it can't read it;
+// a message from srcva >= UTOP is -E_INVAL.
+static int
+ipc_check_perm(void *srcva, unsigned perm)
+{
+	if(perm == IPC_MSG)
+	{
+		// A message has to come from somewhere in user memory
+		if((uintptr_t)srcva >= UTOP)
+			return -E_INVAL;
+		env_lock(curenv);
+		user_mem_assert(curenv, srcva, IPC_MSGSIZE, 0);
+		memmove(curenv->env_ipc_sendmsg, srcva, IPC_MSGSIZE);
+		env_unlock(curenv);
+		return 0;
+	}
+
+	if((uintptr_t)srcva < UTOP)
+	{
+		if((uintptr_t)srcva & (PGSIZE-1))
+			return -E_INVAL;
+		
+		// if perm is inappropriate
+		if(!(perm & PTE_U) || !(perm & PTE_P))
+			return -E_INVAL;
+
+		if(perm & ~PTE_SYSCALL)
+			return -E_INVAL;
+	}
+	return 0;
+}
+
+// Map the page at srcva in src's address space at dstva in dst's,
+// with permission perm, as an IPC page transfer.  No page is sent if
+// srcva >= UTOP, and none is mapped if dstva >= UTOP, but srcva must
+// still be valid.  A message (IPC_MSG) is not a page.
+// Returns 1 if a page was mapped, 0 if not, or < 0 on error.  Errors are:
+//	-E_INVAL if srcva < UTOP but is not mapped in src's address space,
+//		or perm has PTE_W but the page is read-only there.
+//	-E_NO_MEM if there's not enough memory to map it in dst.
+static int
+ipc_map_page(struct Env *src, void *srcva, unsigned perm,
+	     struct Env *dst, void *dstva)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+	int r;
+
+	if ((uintptr_t)srcva >= UTOP || perm == IPC_MSG)
+		return 0;
+	if (!(pp = page_lookup(src->env_pgdir, srcva, &pte)))
+		return -E_INVAL;
+	if ((perm & PTE_W) && !(*pte & PTE_W))
+		return -E_INVAL;
+	if ((uintptr_t)dstva >= UTOP)
+		return 0;
+	if ((r = page_insert(dst->env_pgdir, pp, dstva, perm)) < 0)
+		return r;
+	return 1;
+}
+
+// Will e take a message from 'from' right now?  It must be blocked in
+// sys_ipc_recv, or waiting in sys_ipc_call for from's reply.
+static bool
+ipc_accepts(struct Env *e, struct Env *from)
+{
+	return e->env_ipc_recving &&
+		(!e->env_ipc_recvfrom || e->env_ipc_recvfrom == from->env_id);
+}
+
+// Fill in e's ipc fields with a message from 'from'.  'mapped' is what
+// ipc_map_page returned for its page.  A small message is copied from
+// from's env_ipc_sendmsg.
+static void
+ipc_deliver(struct Env *e, struct Env *from, uint32_t value, unsigned perm,
+	    int mapped)
+{
+	e->env_ipc_value = value;
+	e->env_ipc_from = from->env_id;
+	e->env_ipc_perm = mapped || perm == IPC_MSG ? perm : 0;
+	if (perm == IPC_MSG)
+		memmove(e->env_ipc_msg, from->env_ipc_sendmsg, IPC_MSGSIZE);
+	e->env_ipc_recving = 0;
+	// e has its answer, or a request of its own to serve; either
+	// way it is no longer waiting on the env it last sent to.
+	e->env_ipc_to = 0;
+}
+
+// Queue curenv to send its message to e once e receives, and mark it
+// not runnable.  e inherits our priority while we wait.  The caller
+// holds both envs' locks, which this releases, and must then give up
+// the CPU.
+static void
+ipc_block_on(struct Env *e, uint32_t value, void *srcva, unsigned perm)
+{
+	curenv->env_ipc_sendval = value;
+	curenv->env_ipc_srcva = srcva;
+	curenv->env_ipc_sendperm = perm;
+	curenv->env_ipc_to = e->env_id;
+	env_ipc_wait(e, curenv);
+
+	sched_lock();
+	if (e->env_eff_priority < curenv->env_eff_priority)
+		sched_set_priority(e, curenv->env_eff_priority);
+	__env_set_status(curenv, ENV_NOT_RUNNABLE);
+	sched_unlock();
+	env_unlock2(curenv, e);
+}
+
+// Take the oldest post off e's mailbox and fill in e's ipc fields with
+// it, as though it had been sent.  Returns false if the mailbox is
+// empty.  The caller holds e's lock.
+static bool
+ipc_mbox_take(struct Env *e)
+{
+	struct Ipcpost *p;
+
+	if (e->env_ipc_mbox_head == e->env_ipc_mbox_tail)
+		return false;
+	p = &e->env_ipc_mbox[e->env_ipc_mbox_head++ % IPC_MBOXSIZE];
+	e->env_ipc_value = p->ip_value;
+	e->env_ipc_from = p->ip_from;
+	e->env_ipc_perm = 0;
+	return true;
+}
+
 // Block until a value is ready.  Record that you want to receive
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
@@ -479,35 +752,106 @@ sys_env_set_pgfault_upcall(envid_t envid, void *func)
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
 //
-// This function only returns on error, but the system call will eventually
-// return 0 on success.
+// If senders are already blocked in sys_ipc_send waiting for us, take
+// the first one's message and return 0 at once; the sender is woken up
+// with its result, or if it is in sys_ipc_call, starts waiting for our
+// reply.  Failing that, if anything was posted to us with sys_ipc_post,
+// take the oldest post and return 0 at once.  Failing that, if our
+// doorbell was rung by sys_ipc_notify since we last received, return 0
+// at once with env_ipc_from set to 0.
+//
+// Waiting for a reply is how a client blocks on a server, so the env we
+// sent a request to inherits our priority until it replies or next
+// calls sys_ipc_recv.  A send that answers an env waiting on us is a
+// reply, not a request, and lends nothing.  Any priority we inherited
+// ourselves is dropped here.
+//
+// This function only returns on error or when it doesn't block, but the
+// system call will eventually return 0 on success.
 // Return < 0 on error.  Errors are:
 //	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
 static int
 sys_ipc_recv(void *dstva)
 {
+	struct Env *server, *s;
+	int r;
+
 	if ((uintptr_t)dstva < UTOP && ((uintptr_t)dstva & (PGSIZE-1)))
 		return -E_INVAL;
 
-	curenv->env_status = ENV_NOT_RUNNABLE;
-	curenv->env_ipc_dstva = dstva;
+	// The server's slot may be reused at any time, so check it is
+	// still the same env under the scheduler lock.
+	sched_lock();
+	sched_set_priority(curenv, curenv->env_priority);
+	server = &envs[ENVX(curenv->env_ipc_to)];
+	if (curenv->env_ipc_to &&
+	    server->env_id == curenv->env_ipc_to &&
+	    server->env_status != ENV_FREE &&
+	    server->env_eff_priority < curenv->env_eff_priority)
+		sched_set_priority(server, curenv->env_eff_priority);
+	sched_unlock();
+
+	// A sender whose page can no longer be mapped gets the error, and
+	// we move on to the next.
+	while ((s = env_ipc_take(curenv))) {
+		r = ipc_map_page(s, s->env_ipc_srcva, s->env_ipc_sendperm,
+				 curenv, dstva);
+		if (r >= 0) {
+			ipc_deliver(curenv, s, s->env_ipc_sendval,
+				    s->env_ipc_sendperm, r);
+		}
+		if (r >= 0 && s->env_ipc_calling) {
+			// Its env_ipc_dstva and env_ipc_recvfrom are set
+			s->env_ipc_recving = 1;
+			env_ipc_await(curenv, s);
+		} else {
+			s->env_ipc_recvfrom = 0;
+			s->env_tf.tf_regs.reg_eax = r;
+			env_set_status(s, ENV_RUNNABLE);
+		}
+		s->env_ipc_calling = 0;
+		env_unlock2(curenv, s);
+		if (r >= 0)
+			return 0;
+	}
+
+	// env_ipc_take left us locked with nobody waiting.  Block before
+	// a sender can see env_ipc_recving, so that its wakeup can't be
+	// lost.  env_ipc_to stays set while we wait, so that the env we
+	// sent to can tell its answer is a reply.
 	curenv->env_ipc_value = 0;
 	curenv->env_ipc_perm = 0;
 	curenv->env_ipc_from = 0;
+	if (ipc_mbox_take(curenv)) {
+		env_unlock(curenv);
+		return 0;
+	}
+	if (curenv->env_ipc_notified) {
+		curenv->env_ipc_notified = 0;
+		env_unlock(curenv);
+		return 0;
+	}
+	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_recvfrom = 0;
 	curenv->env_ipc_recving = 1;
-
 	curenv->env_tf.tf_regs.reg_eax = 0;
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	env_unlock(curenv);
+
 	sched_yield();
 
 	return 0;
 }
 
-// Try to send 'value' to the target env 'envid'.
+// Send 'value' to the target env 'envid'.
 // If va != 0, then also send page currently mapped at 'va',
 // so that receiver gets a duplicate mapping of the same page.
 //
-// The send fails with a return value of -E_IPC_NOT_RECV if the
-// target has not requested IPC with sys_ipc_recv.
+// If the target has not requested IPC with sys_ipc_recv, the send fails
+// with -E_IPC_NOT_RECV, unless 'block' is set.  Then we queue up behind
+// any other senders waiting for the target, and sleep until its
+// sys_ipc_recv takes our message.  The target inherits our priority
+// while we wait.
 //
 // Otherwise, the send succeeds, and the target's ipc fields are
 // updated as follows:
@@ -515,8 +859,12 @@ sys_ipc_recv(void *dstva)
 //    env_ipc_from is set to the sending envid;
 //    env_ipc_value is set to the 'value' parameter;
 //    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise.
+// If perm is IPC_MSG, srcva holds a small message instead of a page,
+// and it is copied to the target's env_ipc_msg.
 // The target environment is marked runnable again, returning 0
-// from the paused ipc_recv system call.
+// from the paused ipc_recv system call.  If it can run on this CPU,
+// it runs right away on the rest of our time slice, and we wait for
+// the CPU again.
 //
 // If the sender sends a page but the receiver isn't asking for one,
 // then no page mapping is transferred, but no error occurs.
@@ -525,7 +873,8 @@ sys_ipc_recv(void *dstva)
 // Returns 0 on success where no page mapping occurs,
 // 1 on success where a page mapping occurs, and < 0 on error.
 // Errors are:
-//	-E_BAD_ENV if environment envid doesn't currently exist.
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or exits before taking a blocked send.
 //		(No need to check permissions.)
 //	-E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv,
 //		or another environment managed to send first.
@@ -534,60 +883,447 @@ sys_ipc_recv(void *dstva)
 //		(see sys_page_alloc).
 //	-E_INVAL if srcva < UTOP but srcva is not mapped in the caller's
 //		address space.
+//	-E_INVAL if a blocking send is to the caller itself.
 //	-E_NO_MEM if there's not enough memory to map srcva in envid's
 //		address space.
 static int
-sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+__sys_ipc_send(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	       bool block)
 {
-	struct Env* e;
-	int r, ret;
-	struct PageInfo* pinfo;
-	pte_t *pte;
+	struct Env *e, *self;
+	int r;
+	bool handoff, reply;
 
-	if((r = envid2env(envid, &e, 0)) < 0)
+	if((r = ipc_check_perm(srcva, perm)) < 0)
 		return r;
 
-	if(!e->env_ipc_recving)
-		return -E_IPC_NOT_RECV;
+	if((r = envid2env_lock2(0, &self, envid, &e, 0)) < 0)
+		return r;
 
-	if((uintptr_t)srcva < UTOP)
+	if(!ipc_accepts(e, self))
 	{
-		if((uintptr_t)srcva & (PGSIZE-1))
-			return -E_INVAL;
-		
-		// if perm is inappropriate
-		if(!(perm & PTE_U) || !(perm & PTE_P))
-			return -E_INVAL;
+		r = -E_IPC_NOT_RECV;
+		if(!block)
+			goto out;
+
+		r = -E_INVAL;
+		if(e == self)
+			goto out;
+
+		// Nobody would ever take the message of a dying env, or
+		// fail the send of one waiting on a dying env.
+		r = -E_BAD_ENV;
+		if(e->env_status == ENV_DYING || self->env_status == ENV_DYING)
+			goto out;
+
+		// Check the page now; e checks it again when it takes it.
+		if((r = ipc_map_page(self, srcva, perm, NULL, (void*)UTOP)) < 0)
+			goto out;
+
+		// e's sys_ipc_recv stores our real result
+		self->env_tf.tf_regs.reg_eax = -E_IPC_NOT_RECV;
+		ipc_block_on(e, value, srcva, perm);
+		sched_yield();
+	}
 
-		if(perm & ~PTE_SYSCALL)
-			return -E_INVAL;
+	if((r = ipc_map_page(self, srcva, perm, e, e->env_ipc_dstva)) < 0)
+		goto out;
+
+	// A reply to an env waiting on us lends it nothing, and we give
+	// back what it lent us.  Anything else is a request, and if we
+	// now wait in sys_ipc_recv, e inherits our priority.
+	reply = e->env_ipc_to == self->env_id;
+	ipc_deliver(e, self, value, perm, r);
+	self->env_ipc_to = reply ? 0 : e->env_id;
+
+	// We may not come back here if the CPU goes straight to e.
+	self->env_tf.tf_regs.reg_eax = r;
+	sched_lock();
+	if (reply)
+		sched_set_priority(self, self->env_priority);
+	handoff = sched_wakeup(e);
+	env_unlock2(self, e);
+	if (handoff)
+		env_run(e);
+	sched_unlock();
 
-		if(!(pinfo = page_lookup(curenv->env_pgdir, srcva, &pte)))
-			return -E_INVAL;
+	return r;
 
-		if((perm & PTE_W) && !(*pte & PTE_W))
-			return -E_INVAL;
+out:
+	env_unlock2(self, e);
+	return r;
+}
 
-		if((r = page_insert(e->env_pgdir, pinfo, e->env_ipc_dstva, perm)) < 0)
-			return r;
-		
-		e->env_ipc_perm = perm;
-		ret = 1;
-	}
+// Send without blocking.
+static int
+sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+{
+	return __sys_ipc_send(envid, value, srcva, perm, 0);
+}
+
+// Send, waiting for envid to receive if need be.
+static int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+{
+	return __sys_ipc_send(envid, value, srcva, perm, 1);
+}
+
+// Send a request to envid as sys_ipc_send does, then wait for its reply
+// as sys_ipc_recv(dstva) does, all in one system call.  We are ready
+// for the reply before envid can see the request, so envid's reply
+// can't find us busy, and until it comes we take messages from envid
+// only.  Doorbells stay pending.  envid inherits our priority while
+// we wait, and if it can run on this CPU it runs right away.
+//
+// Returns 0 once the reply has arrived, with our ipc fields filled in as
+// for sys_ipc_recv, or < 0 if the request couldn't be sent.  Errors are
+// those of sys_ipc_send, plus:
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+static int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	     void *dstva)
+{
+	struct Env *e, *self;
+	bool handoff;
+	int r;
+
+	if ((uintptr_t)dstva < UTOP && ((uintptr_t)dstva & (PGSIZE-1)))
+		return -E_INVAL;
+	if ((r = ipc_check_perm(srcva, perm)) < 0)
+		return r;
+	if ((r = envid2env_lock2(0, &self, envid, &e, 0)) < 0)
+		return r;
+
+	r = -E_INVAL;
+	if (e == self)
+		goto out;
+	r = -E_BAD_ENV;
+	if (e->env_status == ENV_DYING || self->env_status == ENV_DYING)
+		goto out;
+
+	if (ipc_accepts(e, self))
+		r = ipc_map_page(self, srcva, perm, e, e->env_ipc_dstva);
 	else
-	{
-		e->env_ipc_perm = 0;
-		ret = 0;
+		r = ipc_map_page(self, srcva, perm, NULL, (void*)UTOP);
+	if (r < 0)
+		goto out;
+
+	// Get ready for the reply.
+	self->env_ipc_dstva = dstva;
+	self->env_ipc_recvfrom = e->env_id;
+	self->env_ipc_value = 0;
+	self->env_ipc_perm = 0;
+	self->env_ipc_from = 0;
+	self->env_tf.tf_regs.reg_eax = 0;
+
+	if (!ipc_accepts(e, self)) {
+		// e's sys_ipc_recv sets env_ipc_recving once it has taken
+		// the request.
+		self->env_ipc_calling = 1;
+		ipc_block_on(e, value, srcva, perm);
+		sched_yield();
 	}
 
-	
-	e->env_ipc_value = value;
-	e->env_ipc_from = curenv->env_id;
+	ipc_deliver(e, self, value, perm, r);
+	self->env_ipc_to = e->env_id;
+	self->env_ipc_recving = 1;
+	env_ipc_await(e, self);
+
+	sched_lock();
+	if (e->env_eff_priority < self->env_eff_priority)
+		sched_set_priority(e, self->env_eff_priority);
+	__env_set_status(self, ENV_NOT_RUNNABLE);
+	handoff = sched_wakeup(e);
+	env_unlock2(self, e);
+	if (handoff)
+		env_run(e);
+	sched_unlock();
+
+	sched_yield();
+
+out:
+	env_unlock2(self, e);
+	return r;
+}
+
+// Reply to a request and wait for the next one, in one system call.
+// This is a server's loop.  If envid is not 0, send it 'value' and the
+// page at 'srcva' as sys_ipc_try_send does, but keep the CPU.  A reply
+// that can't be delivered because the client has gone away, or with a
+// bad page, is dropped.  Then receive as sys_ipc_recv(dstva) does.  If
+// that is going to block, envid can run on this CPU as soon as we do;
+// otherwise it goes to an idle CPU rather than waiting behind us.
+//
+// A client that sent its request with sys_ipc_send may not be
+// receiving yet.  Then nothing is sent or received, and we return
+// -E_IPC_NOT_RECV; ipc_reply_recv() sends the reply the old way.
+//
+// Returns as sys_ipc_recv, or -E_IPC_NOT_RECV as above.
+static int
+sys_ipc_reply_wait(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+		   void *dstva)
+{
+	struct Env *e, *self;
+	bool blocking;
+	int r;
+
+	if ((uintptr_t)dstva < UTOP && ((uintptr_t)dstva & (PGSIZE-1)))
+		return -E_INVAL;
+
+	if (envid && ipc_check_perm(srcva, perm) == 0 &&
+	    envid2env_lock2(0, &self, envid, &e, 0) == 0) {
+		if (e != self && e->env_status != ENV_DYING &&
+		    !ipc_accepts(e, self)) {
+			env_unlock2(self, e);
+			return -E_IPC_NOT_RECV;
+		}
+		if (ipc_accepts(e, self) &&
+		    (r = ipc_map_page(self, srcva, perm, e, e->env_ipc_dstva)) >= 0) {
+			ipc_deliver(e, self, value, perm, r);
+			// A sender could still turn up before we block, but
+			// then e waits for our next tick at worst.
+			blocking = !env_ipc_pending(self) &&
+				self->env_ipc_mbox_head == self->env_ipc_mbox_tail &&
+				!self->env_ipc_notified;
+			sched_lock();
+			if (blocking)
+				sched_wakeup(e);	// runs once we block
+			else
+				sched_wakeup_elsewhere(e);
+			sched_unlock();
+		}
+		env_unlock2(self, e);
+	}
+
+	return sys_ipc_recv(dstva);
+}
+
+// Ring envid's doorbell.  This is a message with no value, page or
+// sender: if envid is blocked in sys_ipc_recv, it wakes up with
+// env_ipc_from set to 0.  Otherwise its next sys_ipc_recv returns that
+// way at once.  Doorbells don't queue, so several rung before envid
+// looks are seen as one.  Used to say that a shared memory ring has
+// new entries.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_ipc_notify(envid_t envid)
+{
+	struct Env *e;
+	bool handoff;
+	int r;
+
+	if ((r = envid2env_lock(envid, &e, 0)) < 0)
+		return r;
+
+	// Doorbells don't wake an env waiting for a call's reply.
+	if (!e->env_ipc_recving || e->env_ipc_recvfrom) {
+		e->env_ipc_notified = 1;
+		env_unlock(e);
+		return 0;
+	}
+
+	e->env_ipc_value = 0;
+	e->env_ipc_from = 0;
+	e->env_ipc_perm = 0;
 	e->env_ipc_recving = 0;
 
-	e->env_status = ENV_RUNNABLE;
+	// We may not come back here if the CPU goes straight to e.
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	sched_lock();
+	handoff = sched_wakeup(e);
+	env_unlock(e);
+	if (handoff)
+		env_run(e);
+	sched_unlock();
+
+	return 0;
+}
+
+// Post 'value' to envid's mailbox without waiting.  If envid is
+// blocked in sys_ipc_recv, it gets the value at once, as from
+// sys_ipc_try_send with no page, and is made runnable; otherwise the
+// value is queued for its next sys_ipc_recv or sys_ipc_drain.  Unlike a
+// send, this never blocks or gives up the CPU, so a burst of posts from
+// many envs is absorbed by the mailbox while envid is busy, and it may
+// be batched with sys_batch.  An env waiting in sys_ipc_call for a
+// reply doesn't take posts until it receives again.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//		(No need to check permissions.)
+//	-E_NO_MEM if envid's mailbox already holds IPC_MBOXSIZE posts.
+static int
+sys_ipc_post(envid_t envid, uint32_t value)
+{
+	struct Env *e;
+	struct Ipcpost *p;
+	int r;
+
+	if ((r = envid2env_lock(envid, &e, 0)) < 0)
+		return r;
+
+	// A receiving env's mailbox is empty, or it would have taken a post.
+	if (e->env_ipc_recving && !e->env_ipc_recvfrom) {
+		e->env_ipc_value = value;
+		e->env_ipc_from = curenv->env_id;
+		e->env_ipc_perm = 0;
+		e->env_ipc_recving = 0;
+		sched_lock();
+		sched_wakeup(e);
+		sched_unlock();
+		env_unlock(e);
+		return 0;
+	}
+
+	if (e->env_ipc_mbox_tail - e->env_ipc_mbox_head >= IPC_MBOXSIZE) {
+		env_unlock(e);
+		return -E_NO_MEM;
+	}
+	p = &e->env_ipc_mbox[e->env_ipc_mbox_tail++ % IPC_MBOXSIZE];
+	p->ip_from = curenv->env_id;
+	p->ip_value = value;
+	env_unlock(e);
+	return 0;
+}
+
+// Take up to n posts off our mailbox, oldest first, and copy them to
+// posts[], so that a server can handle a burst of them in one system
+// call.  Never blocks.
+//
+// Returns the number of posts copied, which is 0 if the mailbox was
+// empty.  Destroys the environment if posts[] is not writable memory.
+static int
+sys_ipc_drain(struct Ipcpost *posts, size_t n)
+{
+	size_t i;
+
+	env_lock(curenv);
+	n = MIN(n, curenv->env_ipc_mbox_tail - curenv->env_ipc_mbox_head);
+	user_mem_assert(curenv, posts, n * sizeof(struct Ipcpost), PTE_W);
+	for (i = 0; i < n; i++)
+		posts[i] = curenv->env_ipc_mbox[curenv->env_ipc_mbox_head++ % IPC_MBOXSIZE];
+	env_unlock(curenv);
+	return n;
+}
+
+// Bind our event channel 'chan' to 'source', replacing whatever it was
+// bound to.  The sources are:
+//	EVT_NONE	Nothing; just unbind the channel.
+//	EVT_NET		The network card's receive interrupt, which only
+//			one env may have bound at a time.
+//	EVT_TIMER	Fire once when time_msec() reaches 'arg'.  We have
+//			one timer, so this replaces any deadline we set on
+//			another channel.  A deadline already past fires
+//			at once.
+//	EVT_ENV		sys_event_signal from env 'arg', or from any env
+//			if 'arg' is 0.
+// A new env starts with every channel unbound and none pending.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if chan or source is invalid.
+//	-E_INVAL if source is EVT_NET and another env has it bound.
+//	-E_NOT_SUPP if source is EVT_NET and the network card doesn't
+//		interrupt us.
+//	-E_BAD_ENV if source is EVT_ENV and env 'arg' doesn't exist.
+static int
+sys_event_bind(int chan, int source, uint32_t arg)
+{
+	struct Env *e;
+	int r = 0;
+
+	if ((unsigned) chan >= NEVTCHAN)
+		return -E_INVAL;
+
+	env_lock(curenv);
+	if (curenv->env_evt_source[chan] == EVT_NET)
+		evt_net_unbind(curenv->env_id);
+	else if (curenv->env_evt_source[chan] == EVT_TIMER)
+		evt_timer_disarm(curenv, chan);
+	curenv->env_evt_source[chan] = EVT_NONE;
+
+	switch (source) {
+	case EVT_NONE:
+		break;
+	case EVT_NET:
+		r = evt_net_bind(curenv->env_id, chan);
+		break;
+	case EVT_TIMER:
+		if (arg <= time_msec())
+			curenv->env_evt_pending |= 1 << chan;
+		else
+			evt_timer_arm(curenv, chan, arg);
+		break;
+	case EVT_ENV:
+		if (arg && (r = envid2env(arg, &e, 0)) < 0)
+			break;
+		curenv->env_evt_peer[chan] = arg;
+		break;
+	default:
+		r = -E_INVAL;
+		break;
+	}
+	if (r >= 0)
+		curenv->env_evt_source[chan] = source;
+	env_unlock(curenv);
+	return r;
+}
+
+// Wait until one of the event channels in 'mask' fires.  Channels that
+// fired since we last waited on them count, so this returns at once if
+// one of them already has.  Otherwise we are marked not runnable until
+// one does, and take no CPU time meanwhile.
+//
+// Returns the channels in 'mask' that fired, which are then cleared,
+// or < 0 on error.  Errors are:
+//	-E_INVAL if mask names no channel.
+static int
+sys_event_wait(uint32_t mask)
+{
+	uint32_t fired;
+
+	mask &= (1 << NEVTCHAN) - 1;
+	if (!mask)
+		return -E_INVAL;
+
+	env_lock(curenv);
+	if ((fired = curenv->env_evt_pending & mask)) {
+		curenv->env_evt_pending &= ~fired;
+		env_unlock(curenv);
+		return fired;
+	}
+	// __evt_raise stores our result
+	curenv->env_evt_waiting = mask;
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	env_unlock(curenv);
+
+	sched_yield();
+}
+
+// Fire event channel 'chan' of env 'envid', which must have bound it to
+// EVT_ENV for us or for any env.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//	-E_INVAL if chan is invalid or envid hasn't bound it for us.
+static int
+sys_event_signal(envid_t envid, int chan)
+{
+	struct Env *e;
+	int r;
 
-	return ret;
+	if ((unsigned) chan >= NEVTCHAN)
+		return -E_INVAL;
+	if ((r = envid2env_lock(envid, &e, 0)) < 0)
+		return r;
+	if (e->env_evt_source[chan] != EVT_ENV ||
+	    (e->env_evt_peer[chan] && e->env_evt_peer[chan] != curenv->env_id))
+		r = -E_INVAL;
+	else
+		__evt_raise(e, chan);
+	env_unlock(e);
+	return r;
 }
 
 // Return the current time.
@@ -608,9 +1344,14 @@ sys_time_msec(void)
 static int
 sys_net_transmit(const void* data, uint16_t len)
 {
+	int r;
+
+	env_lock(curenv);
 	user_mem_assert(curenv, data, len, 0);
+	r = e1000_transmit(data, len);
+	env_unlock(curenv);
 
-	return e1000_transmit(data, len);
+	return r;
 }
 
 // Receive a packet from network in user space
@@ -620,22 +1361,94 @@ sys_net_transmit(const void* data, uint16_t len)
 static int
 sys_net_recv(void* buf)
 {
-	static char recv_tmp_buf[E1000_RBS];
+	static char recv_tmp_bufs[NCPU][E1000_RBS];
+	char *recv_tmp_buf = recv_tmp_bufs[cpunum()];
 	int r;
 	r = e1000_receive(recv_tmp_buf);
 	
 	if(r > 0)
 	{
+		env_lock(curenv);
 		user_mem_assert(curenv, buf, r, 0);
 
 		if(rcr3() != PADDR(curenv->env_pgdir))
 			lcr3(PADDR(curenv->env_pgdir));
 		
 		memcpy(buf, recv_tmp_buf, r);
+		env_unlock(curenv);
 	}
 
 	return r;
 }
+
+// Run one system call from a sys_batch vector.  Only calls that
+// return to the caller without blocking or switching envs may be
+// batched.
+static int
+sys_batch_one(struct Syscall *sc)
+{
+	switch (sc->sc_num) {
+		case SYS_page_alloc:
+		case SYS_page_map:
+		case SYS_page_unmap:
+		case SYS_env_set_status:
+		case SYS_env_set_pgfault_upcall:
+		case SYS_env_set_priority:
+		case SYS_env_set_weight:
+		case SYS_ipc_post:
+			return syscall(sc->sc_num, sc->sc_args[0], sc->sc_args[1],
+				       sc->sc_args[2], sc->sc_args[3], sc->sc_args[4]);
+		default:
+			return -E_INVAL;
+	}
+}
+
+#define SYS_BATCH_CHUNK	32
+
+// Run the n system calls described by calls[] in order, in a single
+// kernel entry, storing each one's return value in its sc_ret.  Stop at
+// the first call that fails; the calls after it are not run.
+// The batchable calls are sys_page_alloc, sys_page_map, sys_page_unmap,
+// sys_env_set_status, sys_env_set_pgfault_upcall, sys_env_set_priority,
+// sys_env_set_weight and sys_ipc_post; any other fails with -E_INVAL.
+//
+// Returns the number of calls that succeeded.  If that is less than n,
+// calls[r].sc_ret holds the error of the call that failed.
+// Destroys the environment if calls[] is not writable memory.
+static int
+sys_batch(struct Syscall *calls, size_t n)
+{
+	struct Syscall chunk[SYS_BATCH_CHUNK];
+	size_t i, j, m;
+	int r = 0;
+
+	for (i = 0; i < n; i += m) {
+		m = MIN(n - i, SYS_BATCH_CHUNK);
+
+		// The calls may remap the vector's pages, so copy it in
+		// and out of the kernel around running them.
+		env_lock(curenv);
+		user_mem_assert(curenv, calls + i, m * sizeof(struct Syscall), PTE_W);
+		memcpy(chunk, calls + i, m * sizeof(struct Syscall));
+		env_unlock(curenv);
+
+		for (j = 0; j < m; j++)
+			if ((r = chunk[j].sc_ret = sys_batch_one(&chunk[j])) < 0)
+				break;
+		if (r < 0)
+			m = j + 1;
+
+		env_lock(curenv);
+		user_mem_assert(curenv, calls + i, m * sizeof(struct Syscall), PTE_W);
+		memcpy(calls + i, chunk, m * sizeof(struct Syscall));
+		env_unlock(curenv);
+
+		if (r < 0)
+			return i + j;
+	}
+	return n;
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
 int32_t
 syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -672,6 +1485,12 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 			return sys_env_resume((envid_t)a1, (snapshotid_t)a2);
 		case SYS_env_set_status:
 			return sys_env_set_status((envid_t)a1, (int)a2);
+		case SYS_env_set_priority:
+			return sys_env_set_priority((envid_t)a1, (int)a2);
+		case SYS_env_set_affinity:
+			return sys_env_set_affinity((envid_t)a1, a2);
+		case SYS_env_set_weight:
+			return sys_env_set_weight((envid_t)a1, a2);
 		case SYS_env_set_pgfault_upcall:
 			return sys_env_set_pgfault_upcall((envid_t)a1, (void*)a2);
 		case SYS_yield:
@@ -679,14 +1498,34 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 			return 0;
 		case SYS_ipc_try_send:
 			return sys_ipc_try_send((envid_t)a1, a2, (void*)a3, a4);
+		case SYS_ipc_send:
+			return sys_ipc_send((envid_t)a1, a2, (void*)a3, a4);
+		case SYS_ipc_call:
+			return sys_ipc_call((envid_t)a1, a2, (void*)a3, a4, (void*)a5);
+		case SYS_ipc_reply_wait:
+			return sys_ipc_reply_wait((envid_t)a1, a2, (void*)a3, a4, (void*)a5);
 		case SYS_ipc_recv:
 			return sys_ipc_recv((void*)a1);
+		case SYS_ipc_notify:
+			return sys_ipc_notify((envid_t)a1);
+		case SYS_ipc_post:
+			return sys_ipc_post((envid_t)a1, a2);
+		case SYS_ipc_drain:
+			return sys_ipc_drain((struct Ipcpost *)a1, a2);
+		case SYS_event_bind:
+			return sys_event_bind((int)a1, (int)a2, a3);
+		case SYS_event_wait:
+			return sys_event_wait(a1);
+		case SYS_event_signal:
+			return sys_event_signal((envid_t)a1, (int)a2);
 		case SYS_time_msec:
 			return sys_time_msec();
 		case SYS_net_transmit:
 			return sys_net_transmit((const void*)a1, (uint16_t)a2);
 		case SYS_net_recv:
 			return sys_net_recv((void*)a1);
+		case SYS_batch:
+			return sys_batch((struct Syscall*)a1, a2);
 		default:
 			return -E_INVAL;
 	}
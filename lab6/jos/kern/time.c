@@ -1,26 +1,29 @@
+#include <inc/x86.h>
 #include <kern/time.h>
-#include <inc/assert.h>
+#include <kern/cpu.h>
+#include <kern/vsyscall.h>
 
-static unsigned int ticks;
+// Time is read from the TSC, calibrated at boot against the LAPIC
+// timer, rather than counted in timer interrupts: CPUs only take
+// timer interrupts when they have something to preempt.
+static uint64_t boot_tsc;
+static uint64_t tsc_per_msec;
 
 void
 time_init(void)
 {
-	ticks = 0;
-}
+	// A timer tick is nominally 10 ms.
+	tsc_per_msec = lapic_timer_calibrate() / 10;
+	boot_tsc = read_tsc();
 
-// This should be called once per timer interrupt.  A timer interrupt
-// fires every 10 ms.
-void
-time_tick(void)
-{
-	ticks++;
-	if (ticks * 10 < ticks)
-		panic("time_tick: time overflowed");
+	// let user code read the time too
+	vsys_set_time(boot_tsc, tsc_per_msec);
 }
 
 unsigned int
 time_msec(void)
 {
-	return ticks * 10;
+	if (!tsc_per_msec)
+		return 0;
+	return (read_tsc() - boot_tsc) / tsc_per_msec;
 }
@@ -5,7 +5,6 @@
 #endif
 
 void time_init(void);
-void time_tick(void);
 unsigned int time_msec(void);
 
 #endif /* JOS_KERN_TIME_H */
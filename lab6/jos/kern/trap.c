@@ -12,6 +12,10 @@
 #include <kern/spinlock.h>
 #include <kern/sched.h>
 #include <kern/time.h>
+#include <kern/vsyscall.h>
+#include <kern/picirq.h>
+#include <kern/e1000.h>
+#include <kern/event.h>
 
 // lab4: commented out to support MP
 // static struct Taskstate ts;
@@ -86,18 +90,13 @@ trap_init(void)
 	SETGATE(idt[T_SYSCALL], 0, GD_KT, T_SYSCALL_HANDLER, 3);
 
 	// set up external interrupts
-	extern void T_IRQ_TIMER_HANDLER();
-	extern void T_IRQ_KBD_HANDLER();
-	extern void T_IRQ_SERIAL_HANDLER();
-	extern void T_IRQ_SPURIOUS_HANDLER();
-	extern void T_IRQ_IDE_HANDLER();
+	extern uint32_t irq_handler_addrs[];
 	extern void T_IRQ_ERROR_HANDLER();
-	SETGATE(idt[IRQ_OFFSET+IRQ_TIMER], 0, GD_KT, T_IRQ_TIMER_HANDLER, 0);
-	SETGATE(idt[IRQ_OFFSET+IRQ_KBD], 0, GD_KT, T_IRQ_KBD_HANDLER, 0);
-	SETGATE(idt[IRQ_OFFSET+IRQ_SERIAL], 0, GD_KT, T_IRQ_SERIAL_HANDLER, 0);
-	SETGATE(idt[IRQ_OFFSET+IRQ_SPURIOUS], 0, GD_KT, T_IRQ_SPURIOUS_HANDLER, 0);
-	SETGATE(idt[IRQ_OFFSET+IRQ_IDE], 0, GD_KT, T_IRQ_IDE_HANDLER, 0);
+	extern void T_IRQ_RESCHED_HANDLER();
+	for (i = 0; i < MAX_IRQS; i++)
+		SETGATE(idt[IRQ_OFFSET+i], 0, GD_KT, irq_handler_addrs[i], 0);
 	SETGATE(idt[IRQ_OFFSET+IRQ_ERROR], 0, GD_KT, T_IRQ_ERROR_HANDLER, 0);
+	SETGATE(idt[IRQ_OFFSET+IRQ_RESCHED], 0, GD_KT, T_IRQ_RESCHED_HANDLER, 0);
 
 
 	// Per-CPU setup 
@@ -126,6 +125,18 @@ trap_init_percpu(void)
 
 	// Load the IDT
 	lidt(&idt_pd);
+
+	// Let user code enter system calls with sysenter, which lands
+	// on this CPU's kernel stack in sysenter_handler.
+	uint32_t edx;
+	extern void sysenter_handler();
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (edx & CPUID_SEP) {
+		wrmsr(MSR_SYSENTER_CS, GD_KT);
+		wrmsr(MSR_SYSENTER_ESP, c->cpu_ts.ts_esp0);
+		wrmsr(MSR_SYSENTER_EIP, (uintptr_t) sysenter_handler);
+		vsys_enable_sysenter();
+	}
 }
 
 void
@@ -199,7 +210,11 @@ trap_dispatch(struct Trapframe *tf)
 				tf->tf_regs.reg_esi);
 			return;
 		case IRQ_OFFSET + IRQ_TIMER:
-			time_tick();
+			lapic_eoi();
+			evt_timer_check();
+			sched_yield();
+			return;
+		case IRQ_OFFSET + IRQ_RESCHED:
 			lapic_eoi();
 			sched_yield();
 			return;
@@ -215,17 +230,55 @@ trap_dispatch(struct Trapframe *tf)
 			break;
 	}
 
+	// The network card interrupts on whichever line PCI routed it to.
+	if (e1000_irq && tf->tf_trapno == IRQ_OFFSET + e1000_irq) {
+		lapic_eoi();
+		irq_eoi_8259A(e1000_irq);
+		e1000_intr();
+		return;
+	}
+
 	// Unexpected trap: The user process or the kernel has a bug.
 	print_trapframe(tf);
 
 	if (tf->tf_cs == GD_KT)
 		panic("unhandled trap in kernel");
 	else {
+		env_lock(curenv);
 		env_destroy(curenv);
 		return;
 	}
 }
 
+// Bookkeeping for a trap or system call from curenv in user mode.
+// Returns curenv's saved trap frame, which is what to look at from here
+// on.
+static struct Trapframe *
+trap_from_user(struct Trapframe *tf)
+{
+	assert(curenv);
+
+	// Charge curenv for the time it just spent in user mode.
+	sched_charge(curenv);
+
+	// Another CPU destroyed curenv while it was running here.
+	if (curenv->env_status == ENV_DYING) {
+		struct Env *e = curenv;
+
+		env_lock(e);
+		env_free(e);
+		env_unlock(e);
+		sched_yield();
+	}
+
+	// Copy trap frame (which is currently on the stack)
+	// into 'curenv->env_tf', so that running the environment
+	// will restart at the trap point.
+	curenv->env_tf = *tf;
+	// The trapframe on the stack should be ignored from here on.
+	return &curenv->env_tf;
+}
+
 void
 trap(struct Trapframe *tf)
 {
@@ -238,10 +291,8 @@ trap(struct Trapframe *tf)
 	if (panicstr)
 		asm volatile("hlt");
 	
-	// Re-acqurie the big kernel lock if we were halted in
-	// sched_yield()
-	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED)
-		lock_kernel();
+	// We may have been halted in sched_halt()
+	xchg(&thiscpu->cpu_status, CPU_STARTED);
 	
 	// Check that interrupts are disabled.  If this assertion
 	// fails, DO NOT be tempted to fix it by inserting a "cli" in
@@ -250,22 +301,7 @@ trap(struct Trapframe *tf)
 
 	if ((tf->tf_cs & 3) == 3) {
 		// Trapped from user mode.
-		assert(curenv);
-
-		lock_kernel();
-
-		if (curenv->env_status == ENV_DYING) {
-			env_free(curenv);
-			curenv = NULL;
-			sched_yield();
-		}
-
-		// Copy trap frame (which is currently on the stack)
-		// into 'curenv->env_tf', so that running the environment
-		// will restart at the trap point.
-		curenv->env_tf = *tf;
-		// The trapframe on the stack should be ignored from here on.
-		tf = &curenv->env_tf;
+		tf = trap_from_user(tf);
 	}
 
 	// Record that tf is the last real trapframe so
@@ -278,10 +314,47 @@ trap(struct Trapframe *tf)
 	// If we made it to this point, then no other environment was
 	// scheduled, so we should return to the current environment
 	// if doing so makes sense.
+	sched_lock();
 	if (curenv && curenv->env_status == ENV_RUNNING)
 		env_run(curenv);
 	else
-		sched_yield();
+		sched_switch();
+}
+
+// The system call half of trap(), for calls made with sysenter.
+// sysenter_handler builds the same trap frame an int $T_SYSCALL would
+// have, so curenv can be switched away from and resumed with iret as
+// usual.  If curenv can carry on, this returns its trap frame instead,
+// and sysenter_handler goes back to it with sysexit.  That skips
+// env_run(), whose cr3 reload flushes the TLB.
+struct Trapframe *
+sysenter_trap(struct Trapframe *tf)
+{
+	asm volatile("cld" ::: "cc");
+
+	extern char *panicstr;
+	if (panicstr)
+		asm volatile("hlt");
+
+	tf = trap_from_user(tf);
+	last_tf = tf;
+
+	// %esi holds the return address, so there is no fifth argument.
+	tf->tf_regs.reg_eax = syscall(
+		tf->tf_regs.reg_eax,
+		tf->tf_regs.reg_edx,
+		tf->tf_regs.reg_ecx,
+		tf->tf_regs.reg_ebx,
+		tf->tf_regs.reg_edi,
+		0);
+
+	sched_lock();
+	if (!curenv || curenv->env_status != ENV_RUNNING)
+		sched_switch();
+	sched_set_timer();
+	sched_unlock();
+	thiscpu->cpu_run_tsc = read_tsc();
+	return tf;
 }
 
 
@@ -304,6 +377,8 @@ page_fault_handler(struct Trapframe *tf)
 
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
+	// Hold curenv's lock while we use its exception stack.
+	env_lock(curenv);
 	
 	// if the user has set up a page fault handler
 	if(curenv->env_pgfault_upcall)
@@ -340,6 +415,7 @@ page_fault_handler(struct Trapframe *tf)
 			tf->tf_esp = UXSTACKTOP - (kvm_uxstacktop - kvm_utf);
 			tf->tf_eip = (uintptr_t) curenv->env_pgfault_upcall;
 
+			env_unlock(curenv);
 			return;
 		}
 	}
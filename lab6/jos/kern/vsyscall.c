@@ -0,0 +1,71 @@
+// The per-CPU vsyscall pages.
+//
+// Every env shares the kernel's page table for the read-only
+// [UENVS, UENVS+PTSIZE) region.  Instead, each CPU gets a copy of that
+// page table whose last entry, UVSYS, maps the CPU's own vsyscall
+// page, and env_run() points the env's page directory at the copy of
+// the CPU it is about to run on.
+
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/vsyscall.h>
+
+#include <kern/pmap.h>
+#include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/vsyscall.h>
+
+static union {
+	struct Vsyscall vs;
+	char pad[PGSIZE];
+} vsys_pages[NCPU] __attribute__ ((aligned(PGSIZE)));
+
+static pte_t vsys_pgtables[NCPU][NPTENTRIES] __attribute__ ((aligned(PGSIZE)));
+
+// Build each CPU's copy of the UENVS page table.
+// Call after mem_init() has mapped envs at UENVS.
+void
+vsys_init(void)
+{
+	pte_t *pt;
+	int i;
+
+	// the envs array must not run into the vsyscall page
+	static_assert(NENV * sizeof(struct Env) <= UVSYS - UENVS);
+
+	pt = KADDR(PTE_ADDR(kern_pgdir[PDX(UENVS)]));
+	for (i = 0; i < NCPU; i++) {
+		memmove(vsys_pgtables[i], pt, PGSIZE);
+		vsys_pgtables[i][PTX(UVSYS)] =
+			PADDR(&vsys_pages[i]) | PTE_U | PTE_P;
+	}
+}
+
+// Publish the TSC calibration that time_msec() uses.
+void
+vsys_set_time(uint64_t boot_tsc, uint64_t tsc_per_msec)
+{
+	int i;
+
+	for (i = 0; i < NCPU; i++) {
+		vsys_pages[i].vs.vs_boot_tsc = boot_tsc;
+		vsys_pages[i].vs.vs_tsc_per_msec = tsc_per_msec;
+	}
+}
+
+// Tell user code that this CPU takes system calls through sysenter.
+void
+vsys_enable_sysenter(void)
+{
+	vsys_pages[cpunum()].vs.vs_sysenter = 1;
+}
+
+// Make this CPU's vsyscall page describe e and appear at UVSYS in e's
+// address space.  The caller reloads cr3 before running e, which
+// flushes any mapping of another CPU's page.
+void
+vsys_load(struct Env *e)
+{
+	vsys_pages[cpunum()].vs.vs_envid = e->env_id;
+	e->env_pgdir[PDX(UENVS)] = PADDR(vsys_pgtables[cpunum()]) | PTE_U | PTE_P;
+}
@@ -0,0 +1,16 @@
+#ifndef JOS_KERN_VSYSCALL_H
+#define JOS_KERN_VSYSCALL_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+void vsys_init(void);
+void vsys_set_time(uint64_t boot_tsc, uint64_t tsc_per_msec);
+void vsys_load(struct Env *e);
+void vsys_enable_sysenter(void);
+
+#endif /* !JOS_KERN_VSYSCALL_H */
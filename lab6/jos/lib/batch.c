@@ -0,0 +1,63 @@
+// Queue up system calls and submit them together with sys_batch,
+// so that long chains of page mapping calls take one kernel entry
+// instead of one each.
+
+#include <inc/lib.h>
+
+#define BATCH_MAX	(PGSIZE / sizeof(struct Syscall))
+
+// The queue fills exactly one page; see batch_page().
+static struct Syscall batch_calls[BATCH_MAX] __attribute__((aligned(PGSIZE)));
+static size_t batch_n;
+
+// Run the queued calls.
+// Returns 0 if they all succeeded, or the error of the first that
+// failed, in which case the ones after it were dropped.
+int
+batch_flush(void)
+{
+	size_t n = batch_n;
+	int r;
+
+	if (n == 0)
+		return 0;
+	batch_n = 0;
+	if ((r = sys_batch(batch_calls, n)) < 0)
+		return r;
+	if (r < n)
+		return batch_calls[r].sc_ret;
+	return 0;
+}
+
+// Queue system call num with the given arguments, running the queue
+// first if it is full.  The call may not have run yet when this
+// returns, so the caller must batch_flush() before relying on it.
+// Returns 0 on success, or the error of a queued call that failed.
+int
+batch_add(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3,
+	  uint32_t a4, uint32_t a5)
+{
+	struct Syscall *sc;
+	int r;
+
+	if (batch_n == BATCH_MAX && (r = batch_flush()) < 0)
+		return r;
+
+	sc = &batch_calls[batch_n++];
+	sc->sc_num = num;
+	sc->sc_args[0] = a1;
+	sc->sc_args[1] = a2;
+	sc->sc_args[2] = a3;
+	sc->sc_args[3] = a4;
+	sc->sc_args[4] = a5;
+	return 0;
+}
+
+// The page holding the queue.  The kernel writes each call's result
+// back into it, so it must not be remapped read-only, e.g. made
+// copy-on-write, by a queued call.
+const void *
+batch_page(void)
+{
+	return batch_calls;
+}
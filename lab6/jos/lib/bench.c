@@ -0,0 +1,82 @@
+// Microbenchmark reporting; see inc/bench.h.
+
+#include <inc/lib.h>
+#include <inc/bench.h>
+#include <inc/vsyscall.h>
+
+void
+bench_init(struct Bench *b, const char *name)
+{
+	b->b_name = name;
+	b->b_n = 0;
+}
+
+// Sort the samples, which are few, in place.
+static void
+bench_sort(uint64_t *s, uint32_t n)
+{
+	uint64_t x;
+	uint32_t i, j;
+
+	for (i = 1; i < n; i++) {
+		x = s[i];
+		for (j = i; j > 0 && s[j - 1] > x; j--)
+			s[j] = s[j - 1];
+		s[j] = x;
+	}
+}
+
+// Return how many operations per second nops operations taking cycles
+// TSC cycles in all amount to, or 0 if the TSC isn't calibrated yet.
+uint64_t
+bench_ops_per_sec(uint64_t nops, uint64_t cycles)
+{
+	if (!cycles || !vsys.vs_tsc_per_msec)
+		return 0;
+	return nops * 1000 * vsys.vs_tsc_per_msec / cycles;
+}
+
+// Print b's samples, sorting them.  Each histogram row counts the
+// samples in [2^k, 2^(k+1)) cycles.
+void
+bench_report(struct Bench *b)
+{
+	uint64_t *s = b->b_samples, sum = 0;
+	uint32_t n = b->b_n, i, count;
+	int k, width;
+
+	if (n == 0) {
+		cprintf("bench %s: no samples\n", b->b_name);
+		return;
+	}
+	bench_sort(s, n);
+	for (i = 0; i < n; i++)
+		sum += s[i];
+
+	cprintf("bench %s: n %u min %llu med %llu p99 %llu max %llu cycles, %llu ops/s\n",
+		b->b_name, n, s[0], s[n / 2], s[n * 99 / 100], s[n - 1],
+		bench_ops_per_sec(n, sum));
+
+	for (i = 0; i < n; i += count) {
+		for (k = 0; k < 63 && (2ULL << k) <= s[i]; k++)
+			;
+		for (count = 0; i + count < n && s[i + count] < (2ULL << k); count++)
+			;
+		width = (count * 50 + n - 1) / n;
+		cprintf("  2^%2d %5u |%.*s\n", k, count, width,
+			"##################################################");
+	}
+}
+
+// Return the number of CPUs, found by trying to pin ourselves to each.
+// Leaves us free to run on any of them.
+int
+bench_ncpu(void)
+{
+	int n;
+
+	for (n = 0; n < 32 && sys_env_set_affinity(0, 1 << n) == 0; n++)
+		;
+	sys_env_set_affinity(0, ~0);
+	return n;
+}
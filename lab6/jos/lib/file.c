@@ -16,17 +16,24 @@ static int
 fsipc(unsigned type, void *dstva)
 {
 	static envid_t fsenv;
+	int perm = PTE_P | PTE_W | PTE_U;
 
 	if (fsenv == 0)
 		fsenv = ipc_find_env(ENV_TYPE_FS);
 
 	static_assert(sizeof(fsipcbuf) == PGSIZE);
 
+	// Requests that fit in a small message and get nothing back but
+	// the result are copied, rather than lending the server our page.
+	static_assert(sizeof(fsipcbuf.flush) <= IPC_MSGSIZE);
+	static_assert(sizeof(fsipcbuf.set_size) <= IPC_MSGSIZE);
+	if (type == FSREQ_FLUSH || type == FSREQ_SET_SIZE || type == FSREQ_SYNC)
+		perm = IPC_MSG;
+
 	if (debug)
 		cprintf("[%08x] to [%08x] fsipc %d %08x\n", thisenv->env_id, fsenv, type, *(uint32_t *)&fsipcbuf);
 
-	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(NULL, dstva, NULL);
+	return ipc_call(fsenv, type, &fsipcbuf, perm, dstva, NULL);
 }
 
 static int devfile_flush(struct Fd *fd);
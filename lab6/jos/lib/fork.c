@@ -64,11 +64,23 @@ pgfault(struct UTrapframe *utf)
 // copy-on-write again if it was already copy-on-write at the beginning of
 // this function?)
 //
+// If batched is set, the mappings are queued with batch_add() rather
+// than made right away.
+//
 // Returns: 0 on success, < 0 on error.
 // It is also OK to panic on error.
 //
 static int
-duppage(envid_t envid, unsigned pn)
+page_map(bool batched, void *va, envid_t dstenv, int perm)
+{
+	if (batched)
+		return batch_add(SYS_page_map, 0, (uint32_t) va, dstenv,
+				 (uint32_t) va, perm);
+	return sys_page_map(0, va, dstenv, va, perm);
+}
+
+static int
+duppage(envid_t envid, unsigned pn, bool batched)
 {
 	int r;
 	uintptr_t va = pn * PGSIZE;
@@ -77,30 +89,30 @@ duppage(envid_t envid, unsigned pn)
 
 	// LAB 4: Your code here.
 	pte = uvpt[pn];
-	perm = PTE_FLAGS(pte);
+	perm = PTE_FLAGS(pte) & PTE_SYSCALL;
 	
 	// LAB 5: if a page table entry has this bit set, the PTE should be copied directly from parent to child in both fork and spawn 
 	if (pte & PTE_SHARE)
 	{
-		if ((r = sys_page_map(0, (void*)va, envid, (void*)va, perm)) < 0)
+		if ((r = page_map(batched, (void*)va, envid, perm)) < 0)
 			return r;
 	}
 	// page is writable or COW due to previous fork
 	else if ((pte & PTE_W) || (pte & PTE_COW))
 	{
 		// map child COW
-		if ((r = sys_page_map(0, (void*)va, envid, (void*)va, PTE_P | PTE_U | PTE_COW)) < 0)
+		if ((r = page_map(batched, (void*)va, envid, PTE_P | PTE_U | PTE_COW)) < 0)
 			return r;
 
 		// map myself COW
-		if ((r = sys_page_map(0, (void*)va, 0, (void*)va, PTE_P | PTE_U | PTE_COW)) < 0)
+		if ((r = page_map(batched, (void*)va, 0, PTE_P | PTE_U | PTE_COW)) < 0)
 			return r;
 	}
 	// page is readonly
 	else
 	{
 		// only necessary to map child
-		if ((r = sys_page_map(0, (void*)va, envid, (void*)va, perm)) < 0)
+		if ((r = page_map(batched, (void*)va, envid, perm)) < 0)
 			return r;
 	}
 
@@ -144,27 +156,37 @@ fork(void)
 		return id;
 	}
 
-	// parent sets up child's address space	
+	// parent sets up child's address space, a batch of mappings
+	// at a time.  The batch queue's own page can't be made
+	// copy-on-write while calls are queued in it, so do it last.
 	for (addr = UTEXT; addr < USTACKTOP; addr += PGSIZE)
 	{
+		if (addr == (uintptr_t) batch_page())
+			continue;
 		if((uvpd[PDX(addr)] & PTE_P) && (uvpt[PGNUM(addr)] & PTE_P))
 		{
-			if((r = duppage(id, PGNUM(addr))) < 0)
+			if((r = duppage(id, PGNUM(addr), 1)) < 0)
 				return r;
 		}
 	}
+	if ((r = batch_flush()) < 0)
+		return r;
+	if ((r = duppage(id, PGNUM(batch_page()), 0)) < 0)
+		return r;
 
 	// allocate an exception stack for the child
-	if((r = sys_page_alloc(id, (void*)(UXSTACKTOP-PGSIZE), PTE_P | PTE_U | PTE_W)) < 0)
+	if((r = batch_add(SYS_page_alloc, id, UXSTACKTOP-PGSIZE, PTE_P | PTE_U | PTE_W, 0, 0)) < 0)
 		return r;
 
 	// register the page fault handler for the child
 	extern void _pgfault_upcall(void);
-	if((r = sys_env_set_pgfault_upcall(id, _pgfault_upcall)) < 0)
+	if((r = batch_add(SYS_env_set_pgfault_upcall, id, (uint32_t) _pgfault_upcall, 0, 0, 0)) < 0)
 		return r;
 
 	// Start the child environment running
-	if ((r = sys_env_set_status(id, ENV_RUNNABLE)) < 0)
+	if ((r = batch_add(SYS_env_set_status, id, ENV_RUNNABLE, 0, 0, 0)) < 0)
+		return r;
+	if ((r = batch_flush()) < 0)
 		return r;
 
 	return id;
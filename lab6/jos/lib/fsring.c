@@ -0,0 +1,158 @@
+// Asynchronous file I/O through a ring shared with the file server.
+// Callers queue reads and writes with fsring_submit(), hand them to the
+// server with fsring_enter(), and collect the results with
+// fsring_reap(), so many requests can be in flight at once and the
+// server handles them in one go.  See struct Fsring in inc/fs.h.
+
+#include <inc/lib.h>
+
+#define debug 0
+
+#define ring		((struct Fsring *) FSRING_VA)
+#define ring_data(slot)	((void *) (FSRING_VA + (1 + (slot)) * PGSIZE))
+
+static envid_t fsenv;
+// Env the ring at FSRING_VA belongs to.  A forked or spawned child
+// inherits the parent's ring mapping, but must set up its own.
+static envid_t ring_owner;
+// SQ index up to which the server has been told about entries.
+static uint32_t ring_entered;
+// Where to copy each slot's data to once its read completes.
+static void *ring_buf[FSRING_NENTRIES];
+
+// Allocate a fresh ring at FSRING_VA and pass its pages to the server.
+static int
+fsring_setup(void)
+{
+	const int perm = PTE_P | PTE_U | PTE_W | PTE_SHARE;
+	uintptr_t va;
+	int r;
+
+	if (fsenv == 0)
+		fsenv = ipc_find_env(ENV_TYPE_FS);
+	static_assert(FSRING_EVTCHAN < NEVTCHAN);
+	if ((r = sys_event_bind(FSRING_EVTCHAN, EVT_ENV, fsenv)) < 0)
+		return r;
+
+	// PTE_SHARE keeps the server and us on the same pages across
+	// fork, rather than copy-on-write copies of them.
+	for (va = FSRING_VA; va < FSRING_VA + FSRING_NPAGES * PGSIZE; va += PGSIZE)
+		if ((r = batch_add(SYS_page_alloc, 0, va, perm, 0, 0)) < 0)
+			return r;
+	if ((r = batch_flush()) < 0)
+		return r;
+
+	for (va = FSRING_VA; va < FSRING_VA + FSRING_NPAGES * PGSIZE; va += PGSIZE)
+		if ((r = ipc_call(fsenv, FSREQ_RING, (void *) va, perm, 0, NULL)) < 0)
+			return r;
+
+	if (debug)
+		cprintf("[%08x] fsring set up\n", thisenv->env_id);
+
+	ring_owner = thisenv->env_id;
+	ring_entered = 0;
+	return 0;
+}
+
+// Queue op (FSRING_READ, FSRING_WRITE or FSRING_FLUSH) on file
+// descriptor fdnum, transferring n bytes between buf and the file at
+// offset.  The seek position is neither used nor updated.  buf must
+// stay valid until the request is reaped; data is passed back with the
+// completion.  The request isn't started until fsring_enter().
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NO_MEM if FSRING_NENTRIES requests are already in flight.
+//	-E_NOT_SUPP if fdnum isn't a file server file.
+//	-E_INVAL if n > PGSIZE or the file wasn't opened for op.
+int
+fsring_submit(int op, int fdnum, void *buf, size_t n, off_t offset,
+	      uint32_t data)
+{
+	struct Fsring_sqe *sqe;
+	struct Fd *fd;
+	uint32_t slot;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	if (n > PGSIZE || offset < 0)
+		return -E_INVAL;
+	if ((op == FSRING_READ && (fd->fd_omode & O_ACCMODE) == O_WRONLY) ||
+	    (op == FSRING_WRITE && (fd->fd_omode & O_ACCMODE) == O_RDONLY))
+		return -E_INVAL;
+
+	if (ring_owner != thisenv->env_id && (r = fsring_setup()) < 0)
+		return r;
+	if (ring->sq_tail - ring->cq_head >= FSRING_NENTRIES)
+		return -E_NO_MEM;
+
+	slot = ring->sq_tail % FSRING_NENTRIES;
+	sqe = &ring->sq[slot];
+	sqe->sqe_op = op;
+	sqe->sqe_data = data;
+	sqe->sqe_fileid = fd->fd_file.id;
+	sqe->sqe_n = n;
+	sqe->sqe_offset = offset;
+	ring_buf[slot] = op == FSRING_READ ? buf : NULL;
+	if (op == FSRING_WRITE)
+		memmove(ring_data(slot), buf, n);
+
+	// The entry must be complete before the server can see it.
+	asm volatile("" : : : "memory");
+	ring->sq_tail++;
+	return 0;
+}
+
+// Tell the server about the requests submitted since the last call,
+// by posting FSREQ_RING to it.  Should its mailbox be full, ring its
+// doorbell instead, which has it look at every ring.
+// Returns 0 on success, < 0 on error.
+int
+fsring_enter(void)
+{
+	int r;
+
+	if (ring_owner != thisenv->env_id || ring_entered == ring->sq_tail)
+		return 0;
+	ring_entered = ring->sq_tail;
+	if ((r = sys_ipc_post(fsenv, FSREQ_RING)) == -E_NO_MEM)
+		r = sys_ipc_notify(fsenv);
+	return r;
+}
+
+// Take the oldest completion off the ring and store it in *cqe.  For a
+// read, the data has been copied to the buffer given to fsring_submit.
+// If none is ready and 'wait' is set, enter any submitted requests and
+// block on FSRING_EVTCHAN until one is, leaving any IPC sent to us
+// meanwhile queued for the caller.  Returns 1 if *cqe was filled in, 0
+// if there was nothing to reap, or < 0 on error.
+int
+fsring_reap(struct Fsring_cqe *cqe, bool wait)
+{
+	void *buf;
+	int r;
+
+	if (ring_owner != thisenv->env_id)
+		return 0;
+
+	while (ring->cq_head == ring->cq_tail) {
+		if (!wait || ring->cq_head == ring->sq_tail)
+			return 0;
+		if ((r = fsring_enter()) < 0)
+			return r;
+		if ((r = sys_event_wait(1 << FSRING_EVTCHAN)) < 0)
+			return r;
+	}
+
+	*cqe = ring->cq[ring->cq_head % FSRING_NENTRIES];
+	cqe->cqe_slot %= FSRING_NENTRIES;
+	buf = ring_buf[cqe->cqe_slot];
+	if (buf && cqe->cqe_res > 0)
+		memmove(buf, ring_data(cqe->cqe_slot), MIN(cqe->cqe_res, PGSIZE));
+
+	// Done with the slot before the server may reuse it.
+	asm volatile("" : : : "memory");
+	ring->cq_head++;
+	return 1;
+}
@@ -9,7 +9,8 @@
 //	*from_env_store.
 // If 'perm_store' is nonnull, then store the IPC sender's page permission
 //	in *perm_store (this is nonzero iff a page was successfully
-//	transferred to 'pg').
+//	transferred to 'pg'), or IPC_MSG if it sent a small message,
+//	which is then in thisenv->env_ipc_msg until the next receive.
 // If the system call fails, then store 0 in *fromenv and *perm (if
 //	they're nonnull) and return the error.
 // Otherwise, return the value sent by the sender
@@ -19,8 +20,28 @@
 //   If 'pg' is null, pass sys_ipc_recv a value that it will understand
 //   as meaning "no page".  (Zero is not the right value, since that's
 //   a perfectly valid place to map a page.)
+//
+// Doorbells rung with sys_ipc_notify are not messages, so ipc_recv
+// skips them; see ipc_recv_notify.
 int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+{
+	envid_t from;
+	int32_t r;
+
+	do {
+		r = ipc_recv_notify(&from, pg, perm_store);
+	} while (r == 0 && from == 0);
+
+	if(from_env_store)
+		*from_env_store = from;
+	return r;
+}
+
+// Like ipc_recv, but also return when our doorbell is rung, in which
+// case *from_env_store and *perm_store are set to 0 and 0 is returned.
+int32_t
+ipc_recv_notify(envid_t *from_env_store, void *pg, int *perm_store)
 {
 	int r;
 	// LAB 4: Your code here.
@@ -38,21 +59,17 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 
 	if(from_env_store)
 		*from_env_store = thisenv->env_ipc_from;
-	if((uintptr_t) pg < UTOP && perm_store)
+	if(perm_store)
 		*perm_store = thisenv->env_ipc_perm;
 
 	// panic("ipc_recv not implemented");
 	return thisenv->env_ipc_value;
 }
 
-// Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
-// This function keeps trying until it succeeds.
-// It should panic() on any error other than -E_IPC_NOT_RECV.
-//
-// Hint:
-//   Use sys_yield() to be CPU-friendly.
-//   If 'pg' is null, pass sys_ipc_try_send a value that it will understand
-//   as meaning "no page".  (Zero is not the right value.)
+// Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv',
+// sleeping in the kernel until 'toenv' receives it.  If 'perm' is
+// IPC_MSG, the first IPC_MSGSIZE bytes at 'pg' are copied instead.
+// It panics on any error.
 void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 {
@@ -61,21 +78,71 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 	if(!pg)
 		pg = (void*) UTOP;
 
-	while(true)
+	if((r = sys_ipc_send(to_env, val, pg, perm)) < 0)
+		panic("ipc_send: %e\n", r);
+}
+
+// Send a request to 'to_env' as ipc_send does and wait for its reply,
+// in one system call.  The reply is received as by ipc_recv into
+// 'rcv_pg' and 'perm_store', and its value is returned.  Only 'to_env'
+// can reply, and it can't find us busy when it does.
+// It panics if the request can't be sent.
+int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm,
+	 void *rcv_pg, int *perm_store)
+{
+	int r;
+
+	if(!pg)
+		pg = (void*) UTOP;
+	if(!rcv_pg)
+		rcv_pg = (void*) UTOP;
+
+	if((r = sys_ipc_call(to_env, val, pg, perm, rcv_pg)) < 0)
+		panic("ipc_call: %e\n", r);
+
+	if(perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
+}
+
+// For servers: reply to 'to_env' with 'val' (and 'pg' with 'perm', if
+// 'pg' is nonnull), then receive the next request as ipc_recv_notify
+// does, in one system call.  If 'to_env' is 0, just receive.  A reply
+// to a client that has gone away is dropped.  A client that used
+// ipc_send and ipc_recv rather than ipc_call may not be receiving yet;
+// then we wait for it, as ipc_send would.
+int32_t
+ipc_reply_recv(envid_t to_env, uint32_t val, void *pg, int perm,
+	       envid_t *from_env_store, void *rcv_pg, int *perm_store)
+{
+	int r;
+
+	if(!pg)
+		pg = (void*) UTOP;
+	if(!rcv_pg)
+		rcv_pg = (void*) UTOP;
+
+	r = sys_ipc_reply_wait(to_env, val, pg, perm, rcv_pg);
+	if(r == -E_IPC_NOT_RECV)
 	{
-		if((r = sys_ipc_try_send(to_env, val, pg, perm)) < 0)
-		{
-			if(r == -E_IPC_NOT_RECV)
-				continue;
-			
-			panic("ipc_send: %e\n", r);
-		}
-
-		break;
+		sys_ipc_send(to_env, val, pg, perm);
+		r = sys_ipc_reply_wait(0, 0, 0, 0, rcv_pg);
+	}
+	if(r < 0)
+	{
+		if(from_env_store)
+			*from_env_store = 0;
+		if(perm_store)
+			*perm_store = 0;
+		return r;
 	}
 
-	// LAB 4: Your code here.
-	// panic("ipc_send not implemented");
+	if(from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if(perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
 }
 
 // Find the first environment of the given type.  We'll use this to
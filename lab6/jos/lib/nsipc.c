@@ -17,16 +17,25 @@ static int
 nsipc(unsigned type)
 {
 	static envid_t nsenv;
+	int perm = PTE_P|PTE_W|PTE_U;
+
 	if (nsenv == 0)
 		nsenv = ipc_find_env(ENV_TYPE_NS);
 
 	static_assert(sizeof(nsipcbuf) == PGSIZE);
 
+	// Requests that fit in a small message and get nothing back but
+	// the result are copied, rather than lending the server our page.
+	static_assert(sizeof(nsipcbuf.bind) <= IPC_MSGSIZE);
+	static_assert(sizeof(nsipcbuf.connect) <= IPC_MSGSIZE);
+	static_assert(sizeof(nsipcbuf.socket) <= IPC_MSGSIZE);
+	if (NSREQ_SMALL(type))
+		perm = IPC_MSG;
+
 	if (debug)
 		cprintf("[%08x] nsipc %d\n", thisenv->env_id, type);
 
-	ipc_send(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
-	return ipc_recv(NULL, NULL, NULL);
+	return ipc_call(nsenv, type, &nsipcbuf, perm, NULL, NULL);
 }
 
 int
@@ -341,11 +341,13 @@ copy_shared_pages(envid_t child)
 			perm = PTE_FLAGS(uvpt[PGNUM(addr)]);
 			if(perm & PTE_SHARE)
 			{
-				if((r = sys_page_map(0, (void*) addr, child, (void*) addr, perm)) < 0)
+				if((r = batch_add(SYS_page_map, 0, addr, child, addr, perm & PTE_SYSCALL)) < 0)
 					panic("copy_shared_pages: %e", r);
 			}
 		}
 	}
+	if((r = batch_flush()) < 0)
+		panic("copy_shared_pages: %e", r);
 
 	return 0;
 }
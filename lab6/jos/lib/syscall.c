@@ -2,6 +2,7 @@
 
 #include <inc/syscall.h>
 #include <inc/lib.h>
+#include <inc/x86.h>
 
 static inline int32_t
 syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -19,17 +20,43 @@ syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	// The last clause tells the assembler that this can
 	// potentially change the condition codes and arbitrary
 	// memory locations.
+	//
+	// If the CPU supports it, use sysenter instead, which is much
+	// cheaper.  sysenter doesn't save a return address or stack
+	// pointer, so we pass them in SI and BP, leaving no room for a
+	// fifth parameter.  A call with a nonzero fifth argument traps
+	// as usual.  That is every sys_page_map, sys_ipc_call and
+	// sys_ipc_reply_wait: their dstva is never 0, and is UTOP when
+	// they take no page.  sysexit returns with our EIP and ESP in DX and CX.
+	//
+	// sysenter also leaves TF set, so while we are being single-
+	// stepped we trap as usual too, and the iret back restores TF
+	// in user mode.
 
-	asm volatile("int %1\n"
-		     : "=a" (ret)
-		     : "i" (T_SYSCALL),
-		       "a" (num),
-		       "d" (a1),
-		       "c" (a2),
-		       "b" (a3),
-		       "D" (a4),
-		       "S" (a5)
-		     : "cc", "memory");
+	if (vsys.vs_sysenter && a5 == 0 && !(read_eflags() & FL_TF))
+		asm volatile("pushl %%ebp\n\t"
+			     "movl %%esp, %%ebp\n\t"
+			     "leal 1f, %%esi\n\t"
+			     "sysenter\n"
+			     "1:\tpopl %%ebp\n"
+			     : "=a" (ret),
+			       "+d" (a1),
+			       "+c" (a2)
+			     : "0" (num),
+			       "b" (a3),
+			       "D" (a4)
+			     : "esi", "cc", "memory");
+	else
+		asm volatile("int %1\n"
+			     : "=a" (ret)
+			     : "i" (T_SYSCALL),
+			       "a" (num),
+			       "d" (a1),
+			       "c" (a2),
+			       "b" (a3),
+			       "D" (a4),
+			       "S" (a5)
+			     : "cc", "memory");
 
 	if(check && ret > 0)
 		panic("syscall %d returned %d (> 0)", num, ret);
@@ -55,8 +82,17 @@ sys_env_destroy(envid_t envid)
 	return syscall(SYS_env_destroy, 1, envid, 0, 0, 0, 0);
 }
 
+// Answered from the vsyscall page, without entering the kernel.
 envid_t
 sys_getenvid(void)
+{
+	return vsys.vs_envid;
+}
+
+// Enter the kernel and come straight back, for measuring what a
+// system call costs.
+envid_t
+sys_null(void)
 {
 	return syscall(SYS_getenvid, 0, 0, 0, 0, 0, 0);
 }
@@ -104,6 +140,24 @@ sys_env_set_status(envid_t envid, int status)
 	return syscall(SYS_env_set_status, 1, envid, status, 0, 0, 0);
 }
 
+int
+sys_env_set_priority(envid_t envid, int prio)
+{
+	return syscall(SYS_env_set_priority, 1, envid, prio, 0, 0, 0);
+}
+
+int
+sys_env_set_affinity(envid_t envid, uint32_t cpumask)
+{
+	return syscall(SYS_env_set_affinity, 1, envid, cpumask, 0, 0, 0);
+}
+
+int
+sys_env_set_weight(envid_t envid, uint32_t weight)
+{
+	return syscall(SYS_env_set_weight, 1, envid, weight, 0, 0, 0);
+}
+
 int
 sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 {
@@ -122,16 +176,81 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
 }
 
+int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, int perm)
+{
+	return syscall(SYS_ipc_send, 0, envid, value, (uint32_t) srcva, perm, 0);
+}
+
+int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ipc_call, 0, envid, value, (uint32_t) srcva, perm, (uint32_t) dstva);
+}
+
+int
+sys_ipc_reply_wait(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ipc_reply_wait, 0, envid, value, (uint32_t) srcva, perm, (uint32_t) dstva);
+}
+
 int
 sys_ipc_recv(void *dstva)
 {
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_notify(envid_t envid)
+{
+	return syscall(SYS_ipc_notify, 0, envid, 0, 0, 0, 0);
+}
+
+int
+sys_ipc_post(envid_t envid, uint32_t value)
+{
+	return syscall(SYS_ipc_post, 0, envid, value, 0, 0, 0);
+}
+
+int
+sys_ipc_drain(struct Ipcpost *posts, size_t n)
+{
+	return syscall(SYS_ipc_drain, 0, (uint32_t) posts, n, 0, 0, 0);
+}
+
+int
+sys_event_bind(int chan, int source, uint32_t arg)
+{
+	return syscall(SYS_event_bind, 0, chan, source, arg, 0, 0);
+}
+
+int
+sys_event_wait(uint32_t mask)
+{
+	return syscall(SYS_event_wait, 0, mask, 0, 0, 0, 0);
+}
+
+int
+sys_event_signal(envid_t envid, int chan)
+{
+	return syscall(SYS_event_signal, 0, envid, chan, 0, 0, 0);
+}
+
+// Answered from the vsyscall page, without entering the kernel.
 unsigned int
 sys_time_msec(void)
 {
-	return (unsigned int) syscall(SYS_time_msec, 0, 0, 0, 0, 0, 0);
+	uint64_t tsc_per_msec = vsys.vs_tsc_per_msec;
+
+	if (!tsc_per_msec)
+		return 0;
+	return (read_tsc() - vsys.vs_boot_tsc) / tsc_per_msec;
+}
+
+int
+sys_batch(struct Syscall *calls, size_t n)
+{
+	return syscall(SYS_batch, 0, (uint32_t)calls, n, 0, 0, 0);
 }
 
 int
@@ -9,9 +9,19 @@ input(envid_t ns_envid)
 	int32_t reqno;
 	envid_t from_envid;
 	char buf[2048];
+	bool evt;
 	
 	binaryname = "ns_input";
 
+	// Sleep on channel 0 while the receive ring is empty, if the card
+	// interrupts us; otherwise poll.
+	evt = sys_event_bind(0, EVT_NET, 0) >= 0;
+
+	// We inherit ns's high priority, at which polling would keep
+	// everything else at normal priority off our CPU.
+	if (!evt)
+		sys_env_set_priority(0, ENV_PRIO_NORMAL);
+
 	// LAB 6: Your code here:
 	// 	- read a packet from the device driver
 	//	- send it to the network server
@@ -33,10 +43,16 @@ input(envid_t ns_envid)
 
 			ipc_send(ns_envid, NSREQ_INPUT, &nsipcbuf, PTE_U | PTE_P);
 		}
-		else
+		else if(r == -E_RX_EMPTY)
 		{
-			if(r != -E_RX_EMPTY)
-				cprintf("%s:%e\n", binaryname, r);
+			// a packet arriving since we looked has already fired
+			// the channel, so the wait returns at once
+			if(evt)
+				sys_event_wait(1 << 0);
+			else
+				sys_yield();
 		}
+		else
+			cprintf("%s:%e\n", binaryname, r);
 	}
 }
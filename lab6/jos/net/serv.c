@@ -180,7 +180,8 @@ process_timer(envid_t envid) {
 struct st_args {
 	int32_t reqno;
 	uint32_t whom;
-	union Nsipc *req;
+	union Nsipc *req;	// the request page, or msg
+	uint32_t msg[IPC_MSGSIZE / 4];	// a request sent as a message
 };
 
 static void
@@ -249,8 +250,10 @@ serve_thread(uint32_t a) {
 	if (args->reqno != NSREQ_INPUT)
 		ipc_send(args->whom, r, 0, 0);
 
-	put_buffer(args->req);
-	sys_page_unmap(0, (void*) args->req);
+	if (args->req != (union Nsipc *) args->msg) {
+		put_buffer(args->req);
+		sys_page_unmap(0, (void*) args->req);
+	}
 	free(args);
 }
 
@@ -282,9 +285,11 @@ serve(void) {
 			continue;
 		}
 
-		// All remaining requests must contain an argument page
-		if (!(perm & PTE_P)) {
+		// All remaining requests must contain an argument page,
+		// or a message if they are small enough
+		if (!(perm & PTE_P) && !(perm == IPC_MSG && NSREQ_SMALL(reqno))) {
 			cprintf("Invalid request from %08x: no argument page\n", whom);
+			put_buffer(va);
 			continue; // just leave it hanging...
 		}
 
@@ -297,6 +302,12 @@ serve(void) {
 		args->reqno = reqno;
 		args->whom = whom;
 		args->req = va;
+		if (perm == IPC_MSG) {
+			// The next receive overwrites the message
+			memmove(args->msg, (void *) thisenv->env_ipc_msg, IPC_MSGSIZE);
+			args->req = (union Nsipc *) args->msg;
+			put_buffer(va);
+		}
 
 		thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
 		thread_yield(); // let the thread created run
@@ -311,6 +322,24 @@ tmain(uint32_t arg) {
 	serve();
 }
 
+// If the kernel pinned us to a core of our own, move ns_input, which
+// polls the card, to the core below so packet input doesn't compete
+// with us, and keep ns_output and ns_timer, which mostly wait for IPC,
+// on ours.  The kernel keeps other envs off both cores.
+static void
+pin_helpers(void)
+{
+	uint32_t mask = thisenv->env_cpumask;
+	int r;
+
+	if (mask == ENV_CPUMASK_ALL || (mask & (mask - 1)) || mask < 4)
+		return;
+	if ((r = sys_env_set_affinity(input_envid, mask >> 1)) < 0
+	    || (r = sys_env_set_affinity(output_envid, mask)) < 0
+	    || (r = sys_env_set_affinity(timer_envid, mask)) < 0)
+		panic("pinning the ns helpers: %e", r);
+}
+
 void
 umain(int argc, char **argv)
 {
@@ -347,6 +376,8 @@ umain(int argc, char **argv)
 		return;
 	}
 
+	pin_helpers();
+
 	// lwIP requires a user threading library; start the library and jump
 	// into a thread to continue initialization.
 	thread_init();
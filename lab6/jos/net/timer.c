@@ -8,25 +8,13 @@ timer(envid_t ns_envid, uint32_t initial_to) {
 	binaryname = "ns_timer";
 
 	while (1) {
-		while((r = sys_time_msec()) < stop && r >= 0) {
-			sys_yield();
-		}
-		if (r < 0)
-			panic("sys_time_msec: %e", r);
+		// Sleep on channel 0 until the deadline
+		if ((r = sys_event_bind(0, EVT_TIMER, stop)) < 0)
+			panic("sys_event_bind: %e", r);
+		if ((r = sys_event_wait(1 << 0)) < 0)
+			panic("sys_event_wait: %e", r);
 
-		ipc_send(ns_envid, NSREQ_TIMER, 0, 0);
-
-		while (1) {
-			uint32_t to, whom;
-			to = ipc_recv((int32_t *) &whom, 0, 0);
-
-			if (whom != ns_envid) {
-				cprintf("NS TIMER: timer thread got IPC message from env %x not NS\n", whom);
-				continue;
-			}
-
-			stop = sys_time_msec() + to;
-			break;
-		}
+		// Only NS can answer a call to NS
+		stop = sys_time_msec() + ipc_call(ns_envid, NSREQ_TIMER, 0, 0, 0, 0);
 	}
 }
@@ -0,0 +1,134 @@
+// Benchmark file server requests, spawn, and pipe throughput.  Then
+// stat from one client per CPU for 1..ncpu CPUs at once and report the
+// requests per second the file server gets through.
+
+#include <inc/lib.h>
+#include <inc/bench.h>
+
+#define NITER	200
+#define NSPAWN	20
+#define NPIPE	200
+#define CHUNK	512
+
+static struct Bench b;
+static char buf[CHUNK];
+
+// Fork one client pinned to each of CPUs 0..k-1, for k = 1..ncpu, and
+// have each time NITER stats and send us its requests per second.
+static void
+stat_scaling(void)
+{
+	envid_t parent = thisenv->env_id, child;
+	struct Stat st;
+	uint64_t t0;
+	uint32_t total;
+	int ncpu = bench_ncpu(), k, i, j, r;
+
+	for (k = 1; k <= ncpu; k++) {
+		for (i = 0; i < k; i++) {
+			if ((child = fork()) < 0)
+				panic("fork: %e", child);
+			if (child == 0) {
+				sys_env_set_affinity(0, 1 << i);
+				t0 = read_tsc();
+				for (j = 0; j < NITER; j++)
+					if ((r = stat("/motd", &st)) < 0)
+						panic("stat /motd: %e", r);
+				ipc_send(parent, bench_ops_per_sec(NITER,
+						read_tsc() - t0), 0, 0);
+				exit();
+			}
+		}
+		for (total = 0, i = 0; i < k; i++)
+			total += ipc_recv(0, 0, 0);
+		cprintf("bench stat %d cpus: %u requests/s\n", k, total);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Stat st;
+	uint64_t cycles;
+	envid_t child;
+	int fd, p[2], i, r;
+
+	bench_init(&b, "open");
+	for (i = 0; i < NITER; i++) {
+		bench_begin(&b);
+		fd = open("/motd", O_RDONLY);
+		bench_end(&b);
+		if (fd < 0)
+			panic("open /motd: %e", fd);
+		close(fd);
+	}
+	bench_report(&b);
+
+	if ((fd = open("/motd", O_RDONLY)) < 0)
+		panic("open /motd: %e", fd);
+	bench_init(&b, "read");
+	for (i = 0; i < NITER; i++) {
+		seek(fd, 0);
+		bench_begin(&b);
+		r = read(fd, buf, sizeof buf);
+		bench_end(&b);
+		if (r <= 0)
+			panic("read /motd: %e", r);
+	}
+	close(fd);
+	bench_report(&b);
+
+	bench_init(&b, "stat");
+	for (i = 0; i < NITER; i++) {
+		bench_begin(&b);
+		r = stat("/motd", &st);
+		bench_end(&b);
+		if (r < 0)
+			panic("stat /motd: %e", r);
+	}
+	bench_report(&b);
+
+	// The time until spawn returns; the child prints and exits.
+	bench_init(&b, "spawn");
+	for (i = 0; i < NSPAWN; i++) {
+		bench_begin(&b);
+		child = spawnl("/hello", "hello", 0);
+		bench_end(&b);
+		if (child < 0)
+			panic("spawn /hello: %e", child);
+		wait(child);
+	}
+	bench_report(&b);
+
+	// Each sample is one CHUNK-byte write to a child reading it all.
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		close(p[1]);
+		while ((r = readn(p[0], buf, sizeof buf)) > 0)
+			;
+		exit();
+	}
+	close(p[0]);
+	bench_init(&b, "pipe write 512");
+	for (i = 0; i < NPIPE; i++) {
+		bench_begin(&b);
+		r = write(p[1], buf, sizeof buf);
+		bench_end(&b);
+		if (r != sizeof buf)
+			panic("write to pipe: %e", r);
+	}
+	close(p[1]);
+	wait(child);
+	for (cycles = 0, i = 0; i < b.b_n; i++)
+		cycles += b.b_samples[i];
+	bench_report(&b);
+	cprintf("bench pipe: %llu bytes/s\n",
+		bench_ops_per_sec(b.b_n, cycles) * sizeof buf);
+
+	stat_scaling();
+
+	cprintf("benchfs OK\n");
+}
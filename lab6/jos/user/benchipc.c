@@ -0,0 +1,128 @@
+// Benchmark IPC round trips made with sys_ipc_try_send and ipc_recv,
+// with and without a page, between two envs on one CPU and on two.
+// Then run one client and server pair per CPU for 1..ncpu CPUs at once
+// and report the round trips per second they add up to.
+
+#include <inc/lib.h>
+#include <inc/bench.h>
+
+#define NITER	500
+#define PGVA	((void *) 0xA0000000)
+#define PERM	(PTE_P|PTE_U|PTE_W)
+
+static struct Bench b;
+
+// Send as the original ipc_send did, retrying until 'to' is receiving.
+static void
+send_spin(envid_t to, uint32_t val, void *pg, int perm)
+{
+	int r;
+
+	while ((r = sys_ipc_try_send(to, val, pg ? pg : (void *) UTOP, perm))
+	       == -E_IPC_NOT_RECV)
+		sys_yield();
+	if (r < 0)
+		panic("sys_ipc_try_send: %e", r);
+}
+
+// Fork an env pinned to CPU 'cpu' that echoes every value, and page,
+// back to its sender until it is destroyed.
+static envid_t
+echo_server(int cpu)
+{
+	envid_t who, server;
+	uint32_t val;
+	int perm, r;
+
+	if ((server = fork()) < 0)
+		panic("fork: %e", server);
+	if (server == 0) {
+		while (1) {
+			val = ipc_recv(&who, PGVA, &perm);
+			send_spin(who, val, perm ? PGVA : 0, perm);
+		}
+	}
+	if ((r = sys_env_set_affinity(server, 1 << cpu)) < 0)
+		panic("sys_env_set_affinity: %e", r);
+	return server;
+}
+
+// Time NITER round trips with 'server', passing a page each way if 'pg'
+// is set.  Returns the total cycles they took.
+static uint64_t
+roundtrips(struct Bench *b, envid_t server, void *pg)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < NITER; i++) {
+		bench_begin(b);
+		send_spin(server, i, pg, pg ? PERM : 0);
+		if (ipc_recv(0, pg, 0) != i)
+			panic("round trip %d came back wrong", i);
+		bench_end(b);
+		sum += b->b_samples[b->b_n - 1];
+	}
+	return sum;
+}
+
+// Run the four round trip benchmarks with us on CPU 0 and the server on
+// CPU 'cpu'.
+static void
+pair(int cpu, const char *name, const char *pgname)
+{
+	envid_t server;
+	int r;
+
+	if ((r = sys_page_alloc(0, PGVA, PERM)) < 0)
+		panic("sys_page_alloc: %e", r);
+	server = echo_server(cpu);
+
+	bench_init(&b, name);
+	roundtrips(&b, server, 0);
+	bench_report(&b);
+
+	bench_init(&b, pgname);
+	roundtrips(&b, server, PGVA);
+	bench_report(&b);
+
+	sys_env_destroy(server);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = thisenv->env_id, client, server;
+	uint64_t cycles;
+	uint32_t total;
+	int ncpu = bench_ncpu(), k, i;
+
+	sys_env_set_affinity(0, 1 << 0);
+	pair(0, "ipc same cpu", "ipc page same cpu");
+	if (ncpu > 1)
+		pair(1, "ipc cross cpu", "ipc page cross cpu");
+
+	// Each client reports its own throughput back to us.
+	sys_env_set_affinity(0, ~0);
+	for (k = 1; k <= ncpu; k++) {
+		for (i = 0; i < k; i++) {
+			if ((client = fork()) < 0)
+				panic("fork: %e", client);
+			if (client == 0) {
+				sys_env_set_affinity(0, 1 << i);
+				server = echo_server(i);
+				bench_init(&b, "ipc scaling");
+				cycles = roundtrips(&b, server, 0);
+				sys_env_destroy(server);
+				ipc_send(parent, bench_ops_per_sec(NITER, cycles),
+					 0, 0);
+				exit();
+			}
+		}
+		for (total = 0, i = 0; i < k; i++)
+			total += ipc_recv(0, 0, 0);
+		cprintf("bench ipc %d cpus: %u round trips/s\n", k, total);
+	}
+
+	cprintf("benchipc OK\n");
+}
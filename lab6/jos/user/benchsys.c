@@ -0,0 +1,131 @@
+// Benchmark system calls: a null call, through sysenter and through
+// int $T_SYSCALL, the page mapping calls, and fork.  Then make null
+// calls from one env per CPU for 1..ncpu CPUs at once and report the
+// calls per second they add up to.
+
+#include <inc/lib.h>
+#include <inc/bench.h>
+#include <inc/syscall.h>
+#include <inc/trap.h>
+
+#define NITER	1000
+#define NFORK	50
+
+#define VA	((void *) 0xA0000000)
+#define VA2	((void *) 0xA0001000)
+
+static struct Bench b_null, b_null_int, b_alloc, b_map, b_unmap, b_fork;
+
+// sys_null the old way.  lib/syscall.c only traps like this when the
+// CPU has no sysenter.
+static envid_t
+sys_null_int(void)
+{
+	envid_t ret;
+
+	asm volatile("int %1\n"
+		     : "=a" (ret)
+		     : "i" (T_SYSCALL),
+		       "a" (SYS_getenvid),
+		       "d" (0), "c" (0), "b" (0), "D" (0), "S" (0)
+		     : "cc", "memory");
+	return ret;
+}
+
+// Fork one env pinned to each of CPUs 0..k-1, for k = 1..ncpu, and
+// have each time NITER null calls and send us its calls per second.
+static void
+null_scaling(void)
+{
+	envid_t parent = thisenv->env_id, child;
+	uint64_t t0;
+	uint32_t total;
+	int ncpu = bench_ncpu(), k, i, j;
+
+	for (k = 1; k <= ncpu; k++) {
+		for (i = 0; i < k; i++) {
+			if ((child = fork()) < 0)
+				panic("fork: %e", child);
+			if (child == 0) {
+				sys_env_set_affinity(0, 1 << i);
+				t0 = read_tsc();
+				for (j = 0; j < NITER; j++)
+					sys_null();
+				ipc_send(parent, bench_ops_per_sec(NITER,
+						read_tsc() - t0), 0, 0);
+				exit();
+			}
+		}
+		for (total = 0, i = 0; i < k; i++)
+			total += ipc_recv(0, 0, 0);
+		cprintf("bench null syscall %d cpus: %u calls/s\n", k, total);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t child;
+	int i, r;
+
+	bench_init(&b_null, "null syscall");
+	for (i = 0; i < NITER; i++) {
+		bench_begin(&b_null);
+		sys_null();
+		bench_end(&b_null);
+	}
+	bench_report(&b_null);
+
+	bench_init(&b_null_int, "null syscall int");
+	for (i = 0; i < NITER; i++) {
+		bench_begin(&b_null_int);
+		sys_null_int();
+		bench_end(&b_null_int);
+	}
+	bench_report(&b_null_int);
+	if (!vsys.vs_sysenter)
+		cprintf("no sysenter: both null syscalls use int\n");
+
+	bench_init(&b_alloc, "sys_page_alloc");
+	bench_init(&b_map, "sys_page_map");
+	bench_init(&b_unmap, "sys_page_unmap");
+	for (i = 0; i < NITER; i++) {
+		bench_begin(&b_alloc);
+		r = sys_page_alloc(0, VA, PTE_P|PTE_U|PTE_W);
+		bench_end(&b_alloc);
+		if (r < 0)
+			panic("sys_page_alloc: %e", r);
+
+		bench_begin(&b_map);
+		r = sys_page_map(0, VA, 0, VA2, PTE_P|PTE_U|PTE_W);
+		bench_end(&b_map);
+		if (r < 0)
+			panic("sys_page_map: %e", r);
+
+		bench_begin(&b_unmap);
+		sys_page_unmap(0, VA2);
+		bench_end(&b_unmap);
+		sys_page_unmap(0, VA);
+	}
+	bench_report(&b_alloc);
+	bench_report(&b_map);
+	bench_report(&b_unmap);
+
+	// The time until fork returns in the parent; the child just exits.
+	bench_init(&b_fork, "fork");
+	for (i = 0; i < NFORK; i++) {
+		bench_begin(&b_fork);
+		child = fork();
+		if (child == 0)
+			exit();
+		bench_end(&b_fork);
+		if (child < 0)
+			panic("fork: %e", child);
+		wait(child);
+	}
+	bench_report(&b_fork);
+
+	null_scaling();
+
+	cprintf("benchsys OK\n");
+}
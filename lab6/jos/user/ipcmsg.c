@@ -0,0 +1,71 @@
+// Check small IPC messages, sent to an env that is already receiving,
+// to one that isn't yet, and as a call and its reply.
+
+#include <inc/lib.h>
+
+static char msg[IPC_MSGSIZE];
+
+static void
+fill(char *p, int seed)
+{
+	int i;
+
+	for (i = 0; i < IPC_MSGSIZE; i++)
+		p[i] = seed + i;
+}
+
+// Receive a message from 'from' and check that it was filled with seed.
+static void
+check(envid_t from, int seed)
+{
+	envid_t who;
+	int perm, value;
+
+	value = ipc_recv(&who, 0, &perm);
+	fill(msg, seed);
+	if (who != from || value != seed || perm != IPC_MSG)
+		panic("got %d from %08x perm %x, want %d from %08x perm %x",
+		      value, who, perm, seed, from, IPC_MSG);
+	if (memcmp((void *) thisenv->env_ipc_msg, msg, IPC_MSGSIZE) != 0)
+		panic("message %d has the wrong contents", seed);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = thisenv->env_id, child, who;
+	int r, perm;
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		// The parent is receiving by now
+		fill(msg, 1);
+		ipc_send(parent, 1, msg, IPC_MSG);
+
+		// The parent isn't receiving yet
+		fill(msg, 2);
+		ipc_send(parent, 2, msg, IPC_MSG);
+
+		// Serve one call and answer it with a message, then wait
+		// for the next one, which never comes
+		check(parent, 3);
+		fill(msg, 4);
+		ipc_reply_recv(parent, 4, msg, IPC_MSG, &who, 0, &perm);
+		panic("ipc_reply_recv returned");
+	}
+
+	check(child, 1);
+	while (envs[ENVX(child)].env_status != ENV_NOT_RUNNABLE)
+		sys_yield();
+	check(child, 2);
+
+	fill(msg, 3);
+	if ((r = ipc_call(child, 3, msg, IPC_MSG, 0, &perm)) != 4 || perm != IPC_MSG)
+		panic("call returned %d perm %x, want 4 perm %x", r, perm, IPC_MSG);
+	fill(msg, 4);
+	if (memcmp((void *) thisenv->env_ipc_msg, msg, IPC_MSGSIZE) != 0)
+		panic("reply has the wrong contents");
+	sys_env_destroy(child);
+	cprintf("ipcmsg OK\n");
+}
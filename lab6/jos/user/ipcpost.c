@@ -0,0 +1,55 @@
+// Check that posts queue up in a busy env's mailbox in order, that a
+// full mailbox refuses more, and that they can be drained in a batch.
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = thisenv->env_id, child, who;
+	struct Ipcpost posts[4];
+	int i, r;
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		// The parent isn't receiving, so these all queue up
+		for (i = 0; i < IPC_MBOXSIZE; i++)
+			if ((r = sys_ipc_post(parent, i)) < 0)
+				panic("post %d: %e", i, r);
+		if ((r = sys_ipc_post(parent, i)) != -E_NO_MEM)
+			panic("post to a full mailbox returned %e", r);
+		ipc_send(parent, 100, 0, 0);
+
+		// The parent is receiving by now
+		while (!envs[ENVX(parent)].env_ipc_recving)
+			sys_yield();
+		if ((r = sys_ipc_post(parent, 200)) < 0)
+			panic("post to a receiving env: %e", r);
+		return;
+	}
+
+	while (envs[ENVX(child)].env_status != ENV_NOT_RUNNABLE)
+		sys_yield();
+
+	// A blocked sender comes before the mailbox
+	if ((r = ipc_recv(&who, 0, 0)) != 100 || who != child)
+		panic("got %d from %08x, want 100 from %08x", r, who, child);
+
+	if ((r = sys_ipc_drain(posts, 4)) != 4)
+		panic("drained %d posts, want 4", r);
+	for (i = 0; i < 4; i++)
+		if (posts[i].ip_value != i || posts[i].ip_from != child)
+			panic("drained %d from %08x, want %d from %08x",
+			      posts[i].ip_value, posts[i].ip_from, i, child);
+	for (; i < IPC_MBOXSIZE; i++)
+		if ((r = ipc_recv(&who, 0, 0)) != i || who != child)
+			panic("got %d from %08x, want %d from %08x",
+			      r, who, i, child);
+	if ((r = sys_ipc_drain(posts, 4)) != 0)
+		panic("drained %d posts from an empty mailbox", r);
+
+	if ((r = ipc_recv(&who, 0, 0)) != 200 || who != child)
+		panic("got %d from %08x, want 200 from %08x", r, who, child);
+	cprintf("ipcpost OK\n");
+}
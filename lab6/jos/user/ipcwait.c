@@ -0,0 +1,58 @@
+// Check that senders to a busy env sleep in the kernel until it
+// receives, rather than spinning, and that each of them gets through.
+// Then check that a sender waiting on an env that exits gets an error.
+
+#include <inc/lib.h>
+
+#define NCHILD		4
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = thisenv->env_id, kids[NCHILD], who, sink;
+	int i, r, got = 0;
+
+	for (i = 0; i < NCHILD; i++) {
+		if ((r = fork()) < 0)
+			panic("fork: %e", r);
+		if (r == 0) {
+			ipc_send(parent, i, 0, 0);
+			exit();
+		}
+		kids[i] = r;
+	}
+
+	// A sender that spins in user space never shows up as not
+	// runnable, so this only finishes once each one sleeps on us.
+	for (i = 0; i < NCHILD; i++)
+		while (envs[ENVX(kids[i])].env_status != ENV_NOT_RUNNABLE)
+			sys_yield();
+
+	for (i = 0; i < NCHILD; i++) {
+		r = ipc_recv(&who, 0, 0);
+		if (r < 0 || r >= NCHILD || who != kids[r] || (got & (1 << r)))
+			panic("bad message %d from %08x", r, who);
+		got |= 1 << r;
+	}
+	cprintf("ipcwait senders OK\n");
+
+	// The sink never receives; its sender must see it go away.
+	if ((sink = fork()) < 0)
+		panic("fork: %e", sink);
+	if (sink == 0)
+		while (1)
+			sys_yield();
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		r = sys_ipc_send(sink, 0, (void *) UTOP, 0);
+		ipc_send(parent, r, 0, 0);
+		exit();
+	}
+	while (envs[ENVX(r)].env_status != ENV_NOT_RUNNABLE)
+		sys_yield();
+	sys_env_destroy(sink);
+	if ((r = ipc_recv(0, 0, 0)) != -E_BAD_ENV)
+		panic("send to an exiting env returned %e", r);
+	cprintf("ipcwait exit OK\n");
+}
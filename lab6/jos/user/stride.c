@@ -0,0 +1,104 @@
+// Check that the scheduler shares the CPU in proportion to env weights.
+// Fork spinning children with weights 1:2:3, confine them all to CPU 0,
+// and compare the cycles each is charged over a couple of seconds.
+// Then run the heaviest alone on CPU 1 for a while, so that its pass
+// races ahead of CPU 0's, move it back, and check the shares again.
+
+#include <inc/lib.h>
+
+#define NCHILD		3
+#define RUNMSEC		2000
+#define SLACK		5	// percentage points
+
+// Read envid's cycle count, which the kernel may update mid-read.
+static uint64_t
+cycles(envid_t envid)
+{
+	const volatile struct Env *e = &envs[ENVX(envid)];
+	uint64_t c;
+
+	do {
+		c = e->env_cycles;
+	} while (c != e->env_cycles);
+	return c;
+}
+
+// Let kids[] run for RUNMSEC and check that each got a share of the
+// CPU in proportion to its weight (i + 1).  Returns 1 if they did.
+static int
+check_shares(envid_t *kids)
+{
+	uint64_t start[NCHILD], used[NCHILD], total = 0;
+	unsigned end;
+	int i, share, want, wsum = 0, ok = 1;
+
+	for (i = 0; i < NCHILD; i++) {
+		start[i] = cycles(kids[i]);
+		wsum += i + 1;
+	}
+	end = sys_time_msec() + RUNMSEC;
+	while (sys_time_msec() < end)
+		sys_yield();
+
+	for (i = 0; i < NCHILD; i++) {
+		used[i] = cycles(kids[i]) - start[i];
+		total += used[i];
+	}
+	if (total == 0)
+		panic("children never ran");
+
+	for (i = 0; i < NCHILD; i++) {
+		share = used[i] * 100 / total;
+		want = (i + 1) * 100 / wsum;
+		cprintf("%08x weight %d: %d%% of the CPU, want %d%%\n",
+			kids[i], (i + 1) * ENV_WEIGHT_DEFAULT, share, want);
+		if (share < want - SLACK || share > want + SLACK)
+			ok = 0;
+	}
+	return ok;
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCHILD], last;
+	unsigned end;
+	int i, r;
+
+	for (i = 0; i < NCHILD; i++) {
+		if ((r = fork()) < 0)
+			panic("fork: %e", r);
+		if (r == 0)
+			while (1)
+				/* spin */;
+		kids[i] = r;
+		if ((r = sys_env_set_affinity(kids[i], 1)) < 0)
+			panic("sys_env_set_affinity: %e", r);
+		if ((r = sys_env_set_weight(kids[i], (i + 1) * ENV_WEIGHT_DEFAULT)) < 0)
+			panic("sys_env_set_weight: %e", r);
+	}
+
+	if (!check_shares(kids))
+		panic("CPU shares do not follow weights");
+
+	// Alone on CPU 1 at weight 1, the last child's pass grows three
+	// times as fast as CPU 0's.  Unless moving back rebases it, it
+	// then starves on CPU 0 for longer than we measure.
+	last = kids[NCHILD - 1];
+	if (sys_env_set_affinity(last, 2) == 0) {
+		sys_env_set_weight(last, ENV_WEIGHT_DEFAULT);
+		end = sys_time_msec() + RUNMSEC;
+		while (sys_time_msec() < end)
+			sys_yield();
+		sys_env_set_weight(last, NCHILD * ENV_WEIGHT_DEFAULT);
+		sys_env_set_affinity(last, 1);
+
+		if (!check_shares(kids))
+			panic("CPU shares do not follow weights after a move");
+	} else
+		cprintf("only one CPU, not checking a move\n");
+
+	for (i = 0; i < NCHILD; i++)
+		sys_env_destroy(kids[i]);
+	cprintf("stride OK\n");
+}
@@ -0,0 +1,41 @@
+// Check that timer and env event channels wake a waiting env, and that
+// an env can't signal a channel it wasn't given.
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = thisenv->env_id, child;
+	unsigned start, now;
+	int r;
+
+	// A timer channel fires once its deadline has passed
+	start = sys_time_msec();
+	if ((r = sys_event_bind(3, EVT_TIMER, start + 100)) < 0)
+		panic("sys_event_bind: %e", r);
+	if ((r = sys_event_wait((1 << 3) | (1 << 4))) != (1 << 3))
+		panic("timer wait returned %x, want %x", r, 1 << 3);
+	if ((now = sys_time_msec()) < start + 100)
+		panic("timer fired after %d ms, want 100", now - start);
+	cprintf("testevent timer OK\n");
+
+	// Channel 5 takes signals from any env, channel 6 from none
+	if ((r = sys_event_bind(5, EVT_ENV, 0)) < 0)
+		panic("sys_event_bind: %e", r);
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		if ((r = sys_event_signal(parent, 6)) != -E_INVAL)
+			panic("signal of an unbound channel returned %e", r);
+		// The parent is asleep by now
+		while (envs[ENVX(parent)].env_status != ENV_NOT_RUNNABLE)
+			sys_yield();
+		if ((r = sys_event_signal(parent, 5)) < 0)
+			panic("sys_event_signal: %e", r);
+		return;
+	}
+	if ((r = sys_event_wait((1 << 5) | (1 << 6))) != (1 << 5))
+		panic("signal wait returned %x, want %x", r, 1 << 5);
+	cprintf("testevent signal OK\n");
+}
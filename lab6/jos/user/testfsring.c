@@ -0,0 +1,124 @@
+// Test asynchronous file I/O through the file server ring.
+// Write more pages than the ring holds with several requests in flight,
+// read them back both through the ring and through read(), and check
+// that a child gets a ring of its own.
+
+#include <inc/lib.h>
+
+#define NPAGES		(2 * FSRING_NENTRIES + 3)
+
+char buf[PGSIZE], rbuf[NPAGES][PGSIZE];
+
+static void
+fill(char *p, int i)
+{
+	int j;
+
+	for (j = 0; j < PGSIZE; j++)
+		p[j] = i * 7 + j;
+}
+
+// Submit, reaping completions while the ring is full.  Every request
+// must succeed with a full page, and completions come back in order.
+static int next_reap;
+
+static void
+reap(void)
+{
+	struct Fsring_cqe cqe;
+	int r;
+
+	if ((r = fsring_reap(&cqe, 1)) != 1)
+		panic("fsring_reap: %e", r);
+	if (cqe.cqe_data != next_reap)
+		panic("completion %d out of order, want %d", cqe.cqe_data, next_reap);
+	if (cqe.cqe_res != PGSIZE)
+		panic("request %d returned %e", cqe.cqe_data, cqe.cqe_res);
+	next_reap++;
+}
+
+static void
+submit(int op, int fd, void *p, int i)
+{
+	int r;
+
+	while ((r = fsring_submit(op, fd, p, PGSIZE, i * PGSIZE, i)) == -E_NO_MEM) {
+		if ((r = fsring_enter()) < 0)
+			panic("fsring_enter: %e", r);
+		reap();
+	}
+	if (r < 0)
+		panic("fsring_submit: %e", r);
+}
+
+static void
+roundtrip(int fd, int first)
+{
+	int i, r;
+
+	next_reap = 0;
+	for (i = 0; i < NPAGES; i++) {
+		fill(buf, first + i);
+		submit(FSRING_WRITE, fd, buf, i);
+	}
+	if ((r = fsring_enter()) < 0)
+		panic("fsring_enter: %e", r);
+	while (next_reap < NPAGES)
+		reap();
+
+	next_reap = 0;
+	for (i = 0; i < NPAGES; i++)
+		submit(FSRING_READ, fd, rbuf[i], i);
+	while (next_reap < NPAGES)
+		reap();
+	for (i = 0; i < NPAGES; i++) {
+		fill(buf, first + i);
+		if (memcmp(rbuf[i], buf, PGSIZE) != 0)
+			panic("fsring read page %d returned wrong data", i);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Fsring_cqe cqe;
+	int fd, i, r, p[2];
+
+	if ((fd = open("/ringfile", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open /ringfile: %e", fd);
+
+	roundtrip(fd, 0);
+	cprintf("fsring write is good\n");
+
+	for (i = 0; i < NPAGES; i++) {
+		fill(buf, i);
+		if ((r = readn(fd, rbuf[0], PGSIZE)) != PGSIZE)
+			panic("read: %e", r);
+		if (memcmp(rbuf[0], buf, PGSIZE) != 0)
+			panic("read page %d returned wrong data", i);
+	}
+	cprintf("fsring read is good\n");
+
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((r = fsring_submit(FSRING_READ, p[0], rbuf[0], PGSIZE, 0, 0)) != -E_NOT_SUPP)
+		panic("fsring_submit on a pipe: got %e, want %e", r, -E_NOT_SUPP);
+	close(p[0]);
+	close(p[1]);
+	if ((r = fsring_submit(FSRING_READ, fd, rbuf[0], PGSIZE + 1, 0, 0)) != -E_INVAL)
+		panic("fsring_submit too big: got %e, want %e", r, -E_INVAL);
+	if ((r = fsring_reap(&cqe, 1)) != 0)
+		panic("fsring_reap with nothing in flight: got %d", r);
+
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		roundtrip(fd, 100);
+		exit();
+	}
+	wait(r);
+	roundtrip(fd, 200);
+	cprintf("fsring fork is good\n");
+
+	close(fd);
+}